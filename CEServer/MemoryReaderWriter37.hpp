@@ -36,6 +36,7 @@
 #define IOCTL_GET_PROCESS_MAPS_COUNT _IOWR(MAJOR_NUM, 0, char *) // 获取进程的内存块地址数量
 #define IOCTL_GET_PROCESS_MAPS_LIST _IOWR(MAJOR_NUM, 1, char *)  // 获取进程的内存块地址列表
 #define IOCTL_CHECK_PROCESS_ADDR_PHY _IOWR(MAJOR_NUM, 2, char *) // 检查进程内存是否有物理内存位置
+#define IOCTL_READ_TO_PIPE _IOWR(MAJOR_NUM, 6, char *)           // 将进程内存页直接放入管道（零拷贝）
 
 class CMemoryReaderWriter {
   public:
@@ -84,6 +85,11 @@ class CMemoryReaderWriter {
         return _rwProcMemDriver_ReadProcessMemory_Fast(m_nDriverLink, hProcess, lpBaseAddress, lpBuffer, nSize, lpNumberOfBytesRead, bIsForceRead);
     }
 
+    // 驱动_读取进程内存到管道（进程句柄，进程内存地址，管道写端FD，读取大小，实际读取字节数，是否暴力读取），返回值：TRUE成功，FALSE失败
+    BOOL ReadProcessMemoryToPipe(uint64_t hProcess, uint64_t lpBaseAddress, int nPipeFd, size_t nSize, size_t *lpNumberOfBytesRead = NULL, BOOL bIsForceRead = FALSE) {
+        return _rwProcMemDriver_ReadProcessMemoryToPipe(m_nDriverLink, hProcess, lpBaseAddress, nPipeFd, nSize, lpNumberOfBytesRead, bIsForceRead);
+    }
+
     // 驱动_写入进程内存（进程句柄，进程内存地址，写入数据缓冲区，写入数据缓冲区大小，实际写入字节数，是否暴力写入），返回值：TRUE成功，FALSE失败
     BOOL WriteProcessMemory(uint64_t hProcess, uint64_t lpBaseAddress, void *lpBuffer, size_t nSize, size_t *lpNumberOfBytesWritten = NULL, BOOL bIsForceWrite = FALSE) {
         return _rwProcMemDriver_WriteProcessMemory(m_nDriverLink, hProcess, lpBaseAddress, lpBuffer, nSize, lpNumberOfBytesWritten, bIsForceWrite);
@@ -258,6 +264,45 @@ class CMemoryReaderWriter {
         return TRUE;
     }
 
+    BOOL _rwProcMemDriver_ReadProcessMemoryToPipe(int nDriverLink, uint64_t hProcess, uint64_t lpBaseAddress, int nPipeFd, size_t nSize, size_t *lpNumberOfBytesRead,
+                                                  BOOL bIsForceRead) {
+        if (lpBaseAddress <= 0) {
+            return FALSE;
+        }
+        if (nDriverLink < 0) {
+            return FALSE;
+        }
+        if (!hProcess) {
+            return FALSE;
+        }
+        if (nSize <= 0) {
+            return FALSE;
+        }
+        struct {
+            int32_t pid;
+            int32_t pipe_fd;
+            uint64_t virt_addr;
+            uint64_t size;
+            uint8_t is_force_read;
+        } param = {0};
+        param.pid = (int32_t)hProcess;
+        param.pipe_fd = nPipeFd;
+        param.virt_addr = lpBaseAddress;
+        param.size = nSize;
+        param.is_force_read = bIsForceRead == TRUE ? 1 : 0;
+
+        int realRead = _rwProcMemDriver_MyIoctl(nDriverLink, IOCTL_READ_TO_PIPE, (unsigned long)&param, sizeof(param));
+        if (realRead < 0) {
+            TRACE("ReadProcessMemoryToPipe ioctl():%s\n", strerror(errno));
+            return FALSE;
+        }
+
+        if (lpNumberOfBytesRead) {
+            *lpNumberOfBytesRead = realRead;
+        }
+        return TRUE;
+    }
+
     BOOL _rwProcMemDriver_WriteProcessMemory(int nDriverLink, uint64_t hProcess, uint64_t lpBaseAddress, void *lpBuffer, size_t nSize, size_t *lpNumberOfBytesWritten,
                                              BOOL bIsForceWrite) {
         if (lpBaseAddress <= 0) {
@@ -524,6 +524,25 @@ int CApi::ReadProcessMemory(HANDLE hProcess, void *lpAddress, void *buffer, int
     return (int)bread;
 }
 
+int CApi::ReadProcessMemoryToPipe(HANDLE hProcess, void *lpAddress, int pipefd, int size) {
+    // returns -1 when the driver cannot splice, so the caller can fall back to ReadProcessMemory
+    size_t bread = 0;
+
+    if (CPortHelper::GetHandleType(hProcess) != htProcesHandle) {
+        return -1;
+    }
+    CeOpenProcess *pCeOpenProcess = (CeOpenProcess *)CPortHelper::GetPointerFromHandle(hProcess);
+
+    // 取出驱动进程句柄
+    uint64_t u64DriverProcessHandle = pCeOpenProcess->u64DriverProcessHandle;
+
+    // 驱动_读取进程内存到管道
+    if (!m_Driver.ReadProcessMemoryToPipe(u64DriverProcessHandle, (uint64_t)lpAddress, pipefd, size, &bread, FALSE)) {
+        return -1;
+    }
+    return (int)bread;
+}
+
 int CApi::WriteProcessMemory(HANDLE hProcess, void *lpAddress, void *buffer, int size) {
     size_t written = 0;
     // printf("WriteProcessMemory(%d, %p, %p, %d\n", hProcess, lpAddress, buffer, size);
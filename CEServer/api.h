@@ -85,6 +85,7 @@ class CApi {
     static int VirtualQueryExFull(HANDLE hProcess, uint32_t flags, std::vector<RegionInfo> &vRinfo);
     static int VirtualQueryEx(HANDLE hProcess, uint64_t lpAddress, RegionInfo &rinfo, std::string &memName);
     static int ReadProcessMemory(HANDLE hProcess, void *lpAddress, void *buffer, int size);
+    static int ReadProcessMemoryToPipe(HANDLE hProcess, void *lpAddress, int pipefd, int size);
     static int WriteProcessMemory(HANDLE hProcess, void *lpAddress, void *buffer, int size);
 
   protected:
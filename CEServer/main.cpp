@@ -8,6 +8,7 @@
 #include <dirent.h>
 #include <elf.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <signal.h>
@@ -90,6 +91,76 @@ ssize_t sendall(int s, void *buf, size_t size, int flags) {
     return totalsent;
 }
 
+// per-thread pipe which the driver fills with target pages for zero-copy reads
+struct SplicePipe {
+    int fds[2] = {-1, -1};
+    int capacity = 0;
+
+    void reset() {
+        if (fds[0] >= 0) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        fds[0] = fds[1] = -1;
+        capacity = 0;
+    }
+    ~SplicePipe() { reset(); }
+};
+static thread_local SplicePipe splicePipe;
+
+// Sends an uncompressed ReadProcessMemory reply by splicing the target pages
+// through a pipe into the socket. Returns FALSE if nothing was sent and the
+// caller has to use the buffered path instead.
+BOOL sendmemory_spliced(int s, CeReadProcessMemoryInput &c) {
+    if (splicePipe.fds[0] < 0) {
+        if (pipe2(splicePipe.fds, O_CLOEXEC) != 0) {
+            splicePipe.fds[0] = splicePipe.fds[1] = -1;
+            return FALSE;
+        }
+        splicePipe.capacity = fcntl(splicePipe.fds[1], F_GETPIPE_SZ);
+    }
+    // the whole reply has to fit, because the read size is sent first. A
+    // pipe slot holds at most one page, so an unaligned read needs a slot
+    // for every page it touches.
+    uintptr_t pageSize = getpagesize();
+    uintptr_t first = (uintptr_t)c.address & ~(pageSize - 1);
+    uintptr_t last = ((uintptr_t)c.address + c.size + pageSize - 1) & ~(pageSize - 1);
+    int needed = (int)(last - first);
+    if (splicePipe.capacity < needed) {
+        int capacity = fcntl(splicePipe.fds[1], F_SETPIPE_SZ, needed);
+        if (capacity < needed) {
+            return FALSE;
+        }
+        splicePipe.capacity = capacity;
+    }
+
+    CeReadProcessMemoryOutput o;
+    o.read = CApi::ReadProcessMemoryToPipe(c.handle, (void *)(uintptr_t)c.address, splicePipe.fds[1], c.size);
+    if (o.read < 0) {
+        return FALSE;
+    }
+
+    if (sendall(s, &o, sizeof(o), o.read ? MSG_MORE : 0) <= 0) {
+        splicePipe.reset();
+        return TRUE;
+    }
+    ssize_t left = o.read;
+    while (left > 0) {
+        ssize_t i = splice(splicePipe.fds[0], NULL, s, NULL, left, SPLICE_F_MOVE);
+        if (i == -1 && errno == EINTR) {
+            continue;
+        }
+        if (i <= 0) {
+            printf("Error during splice: %d. errno=%d\n", (int)i, errno);
+            // drop whatever is still queued in the pipe
+            splicePipe.reset();
+            break;
+        }
+        left -= i;
+    }
+    return TRUE;
+}
+
 int DispatchCommand(int currentsocket, unsigned char command) {
     int r;
     switch (command) {
@@ -343,6 +414,10 @@ int DispatchCommand(int currentsocket, unsigned char command) {
 
         r = recvall(currentsocket, &c, sizeof(c), MSG_WAITALL);
         if (r > 0) {
+            if (!c.compress && sendmemory_spliced(currentsocket, c)) {
+                break;
+            }
+
             CeReadProcessMemoryOutput *o = NULL;
             o = (CeReadProcessMemoryOutput *)malloc(sizeof(CeReadProcessMemoryOutput) + c.size);
             memset(o, 0, sizeof(CeReadProcessMemoryOutput) + c.size);
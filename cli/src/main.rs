@@ -19,10 +19,43 @@ enum Commands {
         len: u8,
         #[clap(value_parser=maybe_hex::<u64>)]
         addr: u64,
+        /// watch all threads of the process
+        #[clap(long)]
+        process: bool,
+    },
+    AddSwwp {
+        pid: i32,
+        #[clap(value_parser=clap::value_parser!(BreakpointType))]
+        bp_type: BreakpointType,
+        #[clap(value_parser=maybe_hex::<u64>)]
+        addr: u64,
+        #[clap(value_parser=maybe_hex::<u64>)]
+        len: u64,
+    },
+    /// software execute breakpoint, not limited by the hardware slots
+    AddSwbp {
+        pid: i32,
+        #[clap(value_parser=maybe_hex::<u64>)]
+        addr: u64,
     },
     DelBp {
         id: i32,
     },
+    /// move a hardware breakpoint without recreating it
+    MoveBp {
+        id: i32,
+        #[clap(value_parser=clap::value_parser!(BreakpointType))]
+        bp_type: BreakpointType,
+        len: u8,
+        #[clap(value_parser=maybe_hex::<u64>)]
+        addr: u64,
+    },
+    DisableBp {
+        id: i32,
+    },
+    EnableBp {
+        id: i32,
+    },
     Continue {
         id: i32,
     },
@@ -67,10 +100,78 @@ enum Commands {
     },
     Step {
         id: i32,
+        /// instructions to step
+        #[clap(default_value_t = 1)]
+        count: u64,
+    },
+    StepUntil {
+        id: i32,
+        #[clap(value_parser=maybe_hex::<u64>)]
+        start: u64,
+        #[clap(value_parser=maybe_hex::<u64>)]
+        end: u64,
+        #[clap(long, default_value_t = 0)]
+        max_steps: u64,
+    },
+    StepOut {
+        id: i32,
+        #[clap(long, default_value_t = 0)]
+        max_steps: u64,
     },
     IsStopped {
         id: i32,
     },
+    HitCount {
+        id: i32,
+    },
+    /// print the hits and stops of several breakpoints from one event queue
+    Watch {
+        ids: Vec<i32>,
+        #[clap(long, default_value_t = 16)]
+        count: usize,
+    },
+    SetHitPolicy {
+        id: i32,
+        ignore_count: u64,
+        every_n: u64,
+    },
+    /// make the function at an execute breakpoint return `value` at once
+    Override {
+        id: i32,
+        #[clap(value_parser=maybe_hex::<u64>)]
+        value: u64,
+    },
+    /// collect the accessing instructions without stopping
+    Aggregate {
+        id: i32,
+        #[clap(default_value_t = 1024)]
+        capacity: u32,
+    },
+    ShowAggregate {
+        id: i32,
+        #[clap(long)]
+        reset: bool,
+    },
+    /// collect the call stacks of the hits without stopping
+    Stacks {
+        id: i32,
+        #[clap(default_value_t = 1024)]
+        capacity: u32,
+        #[clap(long, default_value_t = 16)]
+        depth: u32,
+    },
+    ShowStacks {
+        id: i32,
+        #[clap(long)]
+        reset: bool,
+    },
+    /// print the pc, sp, lr and top of the stack of every thread
+    Threads {
+        pid: i32,
+        /// bytes of stack to print per thread
+        #[clap(long, default_value_t = 32)]
+        stack: u32,
+    },
 }
 
 #[derive(Debug, Clone)]
@@ -93,8 +194,31 @@ fn run_cmd(
             bp_type,
             len,
             addr,
+            process,
         } => {
-            let bp = device.add_bp(pid, bp_type, len, addr)?;
+            let flags = if process {
+                librwmem::BP_FLAG_PROCESS
+            } else {
+                0
+            };
+            let bp = device.add_bp_with_flags(pid, bp_type, len, addr, flags)?;
+            let id = bp.as_raw_fd();
+            bps.insert(id, bp);
+            println!("Breakpoint added: {:?}", id);
+        }
+        Commands::AddSwwp {
+            pid,
+            bp_type,
+            addr,
+            len,
+        } => {
+            let bp = device.add_swwp(pid, bp_type, addr, len, 0)?;
+            let id = bp.as_raw_fd();
+            bps.insert(id, bp);
+            println!("Watchpoint added: {:?}", id);
+        }
+        Commands::AddSwbp { pid, addr } => {
+            let bp = device.add_swbp(pid, addr, 0)?;
             let id = bp.as_raw_fd();
             bps.insert(id, bp);
             println!("Breakpoint added: {:?}", id);
@@ -105,6 +229,29 @@ fn run_cmd(
                 .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
             std::mem::drop(bp);
         }
+        Commands::MoveBp {
+            id,
+            bp_type,
+            len,
+            addr,
+        } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.modify(bp_type, len, addr, 0)?;
+        }
+        Commands::DisableBp { id } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.disable()?;
+        }
+        Commands::EnableBp { id } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.enable()?;
+        }
         Commands::Continue { id } => {
             let bp = bps
                 .get(&id)
@@ -159,19 +306,164 @@ fn run_cmd(
             device.read_mem(pid, addr, &mut buf)?;
             println!("Data:\n{}", pretty_hex::pretty_hex(&buf));
         }
-        Commands::Step { id } => {
+        Commands::Step { id, count } => {
             let bp = bps
                 .get(&id)
                 .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
-            bp.step()?;
+            if count == 1 {
+                bp.step()?;
+            } else {
+                bp.step_n(count)?;
+            }
+        }
+        Commands::StepUntil {
+            id,
+            start,
+            end,
+            max_steps,
+        } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.step_until(start, end, max_steps)?;
+        }
+        Commands::StepOut { id, max_steps } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.step_out(max_steps)?;
         }
         Commands::IsStopped { id } => {
             let bp = bps
                 .get(&id)
                 .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
-            let stopped = bp.is_stopped()?;
+            let stopped = bp.stopped_tid()?;
             println!("Stopped: {:?}", stopped);
         }
+        Commands::Watch { ids, count } => {
+            let queue = device.create_bp_queue(1024)?;
+            for id in &ids {
+                let bp = bps
+                    .get(id)
+                    .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+                bp.set_queue(
+                    &queue,
+                    *id as u64,
+                    librwmem::QUEUE_HITS | librwmem::QUEUE_STOPS,
+                )?;
+            }
+            let mut seen = 0;
+            while seen < count {
+                for event in queue.read_events(count - seen)? {
+                    println!(
+                        "bp {} tid {} {} pc {:#x} addr {:#x}",
+                        event.id,
+                        event.tid,
+                        if event.event_type == 0 { "hit" } else { "stop" },
+                        event.pc,
+                        event.addr
+                    );
+                    seen += 1;
+                }
+            }
+            for id in &ids {
+                bps.get(id).unwrap().clear_queue()?;
+            }
+        }
+        Commands::HitCount { id } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            println!("Hits: {}", bp.hit_count()?);
+            let pool = bp.pool_stats()?;
+            println!(
+                "Stop pool: {}/{} in use, {} dropped",
+                pool.in_use, pool.size, pool.exhausted
+            );
+        }
+        Commands::SetHitPolicy {
+            id,
+            ignore_count,
+            every_n,
+        } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.set_hit_policy(ignore_count, every_n)?;
+        }
+        Commands::Override { id, value } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.set_actions(&[
+                librwmem::Action::set_reg(0, value),
+                librwmem::Action::redirect(30, 0),
+            ])?;
+        }
+        Commands::Aggregate { id, capacity } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.set_aggregate(capacity)?;
+        }
+        Commands::ShowAggregate { id, reset } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            let (entries, dropped) = bp.read_aggregate(16384, reset)?;
+            for e in entries {
+                println!(
+                    "pc: {:#x} hits: {} first addr: {:#x} last tid: {}",
+                    e.pc, e.hits, e.first_addr, e.last_tid
+                );
+            }
+            println!("Dropped: {}", dropped);
+        }
+        Commands::Stacks {
+            id,
+            capacity,
+            depth,
+        } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            bp.set_stacks(capacity, depth)?;
+        }
+        Commands::ShowStacks { id, reset } => {
+            let bp = bps
+                .get(&id)
+                .ok_or_else(|| anyhow::anyhow!("Breakpoint not found"))?;
+            let (mut entries, dropped) = bp.read_stacks(4096, reset)?;
+            entries.sort_by(|a, b| b.hits.cmp(&a.hits));
+            for e in entries {
+                println!(
+                    "hits: {} first addr: {:#x} last tid: {}",
+                    e.hits, e.first_addr, e.last_tid
+                );
+                for frame in e.frames() {
+                    println!("    {:#x}", frame);
+                }
+            }
+            println!("Dropped: {}", dropped);
+        }
+        Commands::Threads { pid, stack } => {
+            let (threads, total) = device.snapshot_threads(pid, 1024, stack)?;
+            for t in threads {
+                println!(
+                    "tid: {} pc: {:#x} sp: {:#x} lr: {:#x}{}",
+                    t.tid,
+                    t.regs.pc,
+                    t.regs.sp,
+                    t.regs.regs[30],
+                    if t.running { " (running)" } else { "" }
+                );
+                for (i, word) in t.stack.chunks_exact(8).enumerate() {
+                    let value = u64::from_ne_bytes(word.try_into().unwrap());
+                    println!("    sp+{:#x}: {:#018x}", i * 8, value);
+                }
+            }
+            println!("Threads: {}", total);
+        }
     }
     Ok(())
 }
@@ -1,11 +1,15 @@
 use bitvec::{order::Lsb0, vec::BitVec};
 use byteorder::{NativeEndian, ReadBytesExt};
-use nix::{ioctl_none, ioctl_write_int, ioctl_write_ptr, request_code_readwrite};
+use nix::{
+    ioctl_none, ioctl_read, ioctl_readwrite, ioctl_write_int, ioctl_write_ptr, request_code_none,
+    request_code_readwrite,
+};
 use std::{
     cmp::max,
     io::{Cursor, Read},
     os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd},
     path::Path,
+    sync::atomic::{AtomicU64, Ordering},
 };
 
 pub mod errors;
@@ -14,9 +18,12 @@ type Result<T> = std::result::Result<T, errors::Error>;
 
 const RWMEM_MAGIC: u8 = 100;
 const RWMEM_BP_MAGIC: u8 = 101;
+const RWMEM_BP_QUEUE_MAGIC: u8 = 102;
+const RWMEM_FREEZE_MAGIC: u8 = 103;
 const IOCTL_GET_PROCESS_MAPS_COUNT: u8 = 0;
 const IOCTL_GET_PROCESS_MAPS_LIST: u8 = 1;
 const IOCTL_CHECK_PROCESS_ADDR_PHY: u8 = 2;
+const IOCTL_READ_TO_PIPE: u8 = 6;
 
 #[derive(Debug, PartialEq, Eq)]
 pub struct MapsEntry {
@@ -31,6 +38,23 @@ pub struct MapsEntry {
 
 pub const DEFAULT_DRIVER_PATH: &str = "/dev/rwmem";
 
+/// create the breakpoint disabled, it has to be armed with `Breakpoint::enable`.
+pub const BP_FLAG_DISABLED: u8 = 0x1;
+/// watch every current and future thread of the process, not only the thread `pid`. Such a
+/// breakpoint can not be created with `BP_FLAG_DISABLED`, nor be enabled, disabled or modified.
+/// Kernels before 5.13 can not keep child processes from inheriting it and give EOPNOTSUPP.
+pub const BP_FLAG_PROCESS: u8 = 0x2;
+/// set by `add_bp_range`.
+pub const BP_FLAG_RANGE: u8 = 0x4;
+
+/// report every counted hit of a breakpoint to its queue, see `Breakpoint::set_queue`.
+pub const QUEUE_HITS: u32 = 0x1;
+/// report every thread which stops at a breakpoint to its queue.
+pub const QUEUE_STOPS: u32 = 0x2;
+
+/// pseudo register id of the accessed address, usable in `LogConfig::mem_reg`.
+pub const REG_ACCESS_ADDR: u32 = 34;
+
 #[repr(transparent)]
 #[derive(Debug)]
 pub struct Device {
@@ -114,6 +138,46 @@ impl Device {
         Ok(())
     }
 
+    /// splice the memory of a process into the write end of a pipe without copying it.
+    /// return the number of bytes queued in the pipe, which stops at the first unmapped page
+    /// or when the pipe is full.
+    pub fn read_mem_to_pipe(
+        &self,
+        pid: i32,
+        addr: u64,
+        size: usize,
+        pipe_fd: RawFd,
+        force: bool,
+    ) -> Result<usize> {
+        #[repr(C)]
+        struct ReadToPipeParam {
+            pid: i32,
+            pipe_fd: i32,
+            addr: u64,
+            size: u64,
+            force: u8,
+        }
+        let param = ReadToPipeParam {
+            pid,
+            pipe_fd,
+            addr,
+            size: size as u64,
+            force: force as u8,
+        };
+        let real_read = nix::errno::Errno::result(unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_readwrite!(
+                    RWMEM_MAGIC,
+                    IOCTL_READ_TO_PIPE,
+                    std::mem::size_of::<usize>()
+                ),
+                &param,
+            )
+        })?;
+        Ok(real_read as usize)
+    }
+
     /// get the memory map of a process.
     pub fn get_mem_map(&self, pid: i32, phy_only: bool) -> Result<Vec<MapsEntry>> {
         let count = self.get_mem_map_count(pid)?;
@@ -259,6 +323,18 @@ impl Device {
         bp_type: BreakpointType,
         len: u8,
         addr: u64,
+    ) -> Result<Breakpoint> {
+        self.add_bp_with_flags(pid, bp_type, len, addr, 0)
+    }
+
+    /// add bp with `BP_FLAG_*` flags
+    pub fn add_bp_with_flags(
+        &self,
+        pid: i32,
+        bp_type: BreakpointType,
+        len: u8,
+        addr: u64,
+        flags: u8,
     ) -> Result<Breakpoint> {
         let mut buf = [0u8; 16];
 
@@ -270,18 +346,282 @@ impl Device {
             BreakpointType::Execute => 4,
         };
         buf[5] = len;
+        buf[6] = flags;
+        buf[8..16].copy_from_slice(&addr.to_ne_bytes());
+        let fd = nix::errno::Errno::result(unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_readwrite!(RWMEM_MAGIC, 3, std::mem::size_of::<usize>()),
+                buf.as_ptr(),
+                16,
+            )
+        })?;
+        Ok(Breakpoint::from_raw_fd(fd))
+    }
+
+    /// add many hardware breakpoints in one syscall. Returns one result per spec in
+    /// order. With `atomic` either all of them are created or none, the failed spec
+    /// then has its error and all the others `ECANCELED`.
+    pub fn add_bps(
+        &self,
+        specs: &[BpSpec],
+        atomic: bool,
+    ) -> Result<Vec<std::result::Result<Breakpoint, nix::errno::Errno>>> {
+        #[repr(C)]
+        struct BatchEntry {
+            pid: i32,
+            bp_type: u8,
+            len: u8,
+            flags: u8,
+            _pad: u8,
+            addr: u64,
+            range_len: u64,
+            result: i32,
+            _reserved: u32,
+        }
+        #[repr(C)]
+        struct BatchParam {
+            entries: u64,
+            count: u32,
+            flags: u32,
+        }
+        let mut entries: Vec<BatchEntry> = specs
+            .iter()
+            .map(|s| BatchEntry {
+                pid: s.pid,
+                bp_type: match s.bp_type {
+                    BreakpointType::Read => 1,
+                    BreakpointType::Write => 2,
+                    BreakpointType::ReadWrite => 3,
+                    BreakpointType::Execute => 4,
+                },
+                len: s.len,
+                flags: s.flags | if s.range_len != 0 { BP_FLAG_RANGE } else { 0 },
+                _pad: 0,
+                addr: s.addr,
+                range_len: s.range_len,
+                result: -(libc::ECANCELED),
+                _reserved: 0,
+            })
+            .collect();
+        let param = BatchParam {
+            entries: entries.as_mut_ptr() as u64,
+            count: entries.len() as u32,
+            flags: atomic as u32,
+        };
+        let ret = unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_readwrite!(RWMEM_MAGIC, 9, std::mem::size_of::<usize>()),
+                &param,
+            )
+        };
+        // an atomic batch which failed at an entry still reports the entries
+        if ret < 0 && entries.iter().all(|e| e.result == -(libc::ECANCELED)) {
+            return Err(nix::errno::Errno::last().into());
+        }
+        Ok(entries
+            .iter()
+            .map(|e| {
+                if e.result >= 0 {
+                    Ok(Breakpoint::from_raw_fd(e.result))
+                } else {
+                    Err(nix::errno::Errno::from_i32(-e.result))
+                }
+            })
+            .collect())
+    }
+
+    /// add a hardware watchpoint on `[addr, addr + len)`. Ranges larger than the
+    /// doubleword they start in use the address mask of the watchpoint on the smallest
+    /// aligned power-of-two block around them, up to 2 GiB, and hits outside the range are
+    /// filtered by the driver. This needs `patch/watchpoint_mask.patch`.
+    pub fn add_bp_range(
+        &self,
+        pid: i32,
+        bp_type: BreakpointType,
+        addr: u64,
+        len: u64,
+        flags: u8,
+    ) -> Result<Breakpoint> {
+        let mut buf = [0u8; 24];
+
+        buf[0..4].copy_from_slice(&pid.to_ne_bytes());
+        buf[4] = match bp_type {
+            BreakpointType::Read => 1,
+            BreakpointType::Write => 2,
+            BreakpointType::ReadWrite => 3,
+            BreakpointType::Execute => return Err(nix::errno::Errno::EINVAL.into()),
+        };
+        buf[6] = flags | BP_FLAG_RANGE;
         buf[8..16].copy_from_slice(&addr.to_ne_bytes());
+        buf[16..24].copy_from_slice(&len.to_ne_bytes());
         let fd = nix::errno::Errno::result(unsafe {
             libc::ioctl(
                 self.fd.as_raw_fd(),
                 request_code_readwrite!(RWMEM_MAGIC, 3, std::mem::size_of::<usize>()),
                 buf.as_ptr(),
+                24,
+            )
+        })?;
+        Ok(Breakpoint::from_raw_fd(fd))
+    }
+
+    /// add a software watchpoint, which protects the pages covering `[addr, addr + len)`
+    /// instead of using a hardware slot. It can watch ranges of any length up to 512 pages
+    /// and behaves like a hardware watchpoint otherwise. Execute is not supported.
+    pub fn add_swwp(
+        &self,
+        pid: i32,
+        bp_type: BreakpointType,
+        addr: u64,
+        len: u64,
+        flags: u8,
+    ) -> Result<Breakpoint> {
+        let mut buf = [0u8; 24];
+
+        buf[0..4].copy_from_slice(&pid.to_ne_bytes());
+        buf[4] = match bp_type {
+            BreakpointType::Read => 1,
+            BreakpointType::Write => 2,
+            BreakpointType::ReadWrite => 3,
+            BreakpointType::Execute => return Err(nix::errno::Errno::EINVAL.into()),
+        };
+        buf[5] = flags;
+        buf[8..16].copy_from_slice(&addr.to_ne_bytes());
+        buf[16..24].copy_from_slice(&len.to_ne_bytes());
+        let fd = nix::errno::Errno::result(unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_readwrite!(RWMEM_MAGIC, 7, std::mem::size_of::<usize>()),
+                buf.as_ptr(),
+                24,
+            )
+        })?;
+        Ok(Breakpoint::from_raw_fd(fd))
+    }
+
+    /// add a software execute breakpoint, which replaces the instruction at `addr` with a
+    /// BRK instead of using a hardware slot. There is no limit on their number; a hit is
+    /// reported like a hit of a hardware breakpoint. The first hit maps one area in the target
+    /// which the instructions of all its breakpoints run in, it goes away with the last of them.
+    /// Exclusives, exceptions and authenticated branches give EINVAL, ENOSPC once the area is full.
+    pub fn add_swbp(&self, pid: i32, addr: u64, flags: u8) -> Result<Breakpoint> {
+        let mut buf = [0u8; 16];
+
+        buf[0..4].copy_from_slice(&pid.to_ne_bytes());
+        buf[4] = flags;
+        buf[8..16].copy_from_slice(&addr.to_ne_bytes());
+        let fd = nix::errno::Errno::result(unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_readwrite!(RWMEM_MAGIC, 10, std::mem::size_of::<usize>()),
+                buf.as_ptr(),
                 16,
             )
         })?;
         Ok(Breakpoint::from_raw_fd(fd))
     }
 
+    /// create an event queue which many breakpoints can report to, holding up to
+    /// `capacity` events.
+    pub fn create_bp_queue(&self, capacity: u32) -> Result<BpQueue> {
+        let fd = nix::errno::Errno::result(unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_none!(RWMEM_MAGIC, 8),
+                capacity as libc::c_ulong,
+            )
+        })?;
+        Ok(BpQueue {
+            fd: unsafe { OwnedFd::from_raw_fd(fd) },
+        })
+    }
+
+    /// park every thread of the process `pid` at its next return to user mode, so its
+    /// memory can be read without it changing. The threads resume together when the
+    /// `Freeze` is thawed or dropped, or by themselves after `timeout_ms` (at most 60 s,
+    /// 0 for that). `flags` may hold `FREEZE_INTERRUPT`.
+    pub fn freeze(&self, pid: i32, timeout_ms: u32, flags: u32) -> Result<Freeze> {
+        #[repr(C)]
+        struct FreezeParam {
+            pid: i32,
+            timeout_ms: u32,
+            flags: u32,
+        }
+        let param = FreezeParam {
+            pid,
+            timeout_ms,
+            flags,
+        };
+        let fd = nix::errno::Errno::result(unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_readwrite!(RWMEM_MAGIC, 11, std::mem::size_of::<usize>()),
+                &param,
+            )
+        })?;
+        Ok(Freeze {
+            fd: unsafe { OwnedFd::from_raw_fd(fd) },
+        })
+    }
+
+    /// the registers and `stack_len` bytes of the stack (from sp, a multiple of 8) of up
+    /// to `max_threads` threads of the process `pid`, in one call. Also returns the number
+    /// of threads in the process. The registers of a running thread are those of its last
+    /// entry into the kernel, freeze the process first for exact ones.
+    pub fn snapshot_threads(
+        &self,
+        pid: i32,
+        max_threads: u32,
+        stack_len: u32,
+    ) -> Result<(Vec<ThreadSnapshot>, u32)> {
+        #[repr(C)]
+        struct SnapshotParam {
+            pid: i32,
+            max_threads: u32,
+            buf: u64,
+            stack_len: u32,
+            threads: u32,
+        }
+        const HEADER_SIZE: usize = 16 + std::mem::size_of::<Regs>();
+        let record_size = HEADER_SIZE + stack_len as usize;
+        let mut buf = vec![0u8; record_size * max_threads as usize];
+        let mut param = SnapshotParam {
+            pid,
+            max_threads,
+            buf: buf.as_mut_ptr() as u64,
+            stack_len,
+            threads: 0,
+        };
+        let written = nix::errno::Errno::result(unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_readwrite!(RWMEM_MAGIC, 12, std::mem::size_of::<usize>()),
+                &mut param,
+            )
+        })?;
+        let snapshots = buf
+            .chunks_exact(record_size)
+            .take(written as usize)
+            .map(|record| {
+                let mut cursor = Cursor::new(record);
+                let tid = cursor.read_i32::<NativeEndian>().unwrap();
+                let flags = cursor.read_u32::<NativeEndian>().unwrap();
+                let stack_valid = cursor.read_u32::<NativeEndian>().unwrap();
+                let regs =
+                    unsafe { std::ptr::read_unaligned(record[16..].as_ptr() as *const Regs) };
+                ThreadSnapshot {
+                    tid,
+                    running: flags & 1 != 0,
+                    regs,
+                    stack: record[HEADER_SIZE..HEADER_SIZE + stack_valid as usize].to_vec(),
+                }
+            })
+            .collect();
+        Ok((snapshots, param.threads))
+    }
+
     pub fn get_num_brps(&self) -> Result<i32> {
         ioctl_none!(get_num_brps, RWMEM_MAGIC, 4);
         let num = unsafe { get_num_brps(self.fd.as_raw_fd()) }?;
@@ -346,6 +686,621 @@ impl std::str::FromStr for BreakpointType {
 
 pub type AllRegs = (Regs, SimdRegs);
 
+/// what a logpoint records on every hit.
+#[repr(C)]
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct LogConfig {
+    /// registers to record, bit n for register n (x0-x30, sp, pc, pstate).
+    pub reg_mask: u64,
+    /// base register of the memory to record, or `REG_ACCESS_ADDR`.
+    pub mem_reg: u32,
+    /// bytes of memory to record, at most one page.
+    pub mem_len: u32,
+    /// added to the value of `mem_reg`.
+    pub mem_offset: i64,
+    /// data pages of the ring buffer, a power of two.
+    pub ring_pages: u32,
+    /// `LOG_NEW_VALUE` or 0.
+    pub flags: u32,
+}
+
+/// record the memory of a logpoint again after the instruction which hit has run,
+/// see `LogRecord::new_mem`. `mem_len` is at most `LOG_VALUE_MAX` then.
+pub const LOG_NEW_VALUE: u32 = 0x1;
+pub const LOG_VALUE_MAX: u32 = 64;
+
+/// a row of the table of an aggregating breakpoint, one per unique pc.
+#[repr(C)]
+#[derive(Debug, Clone)]
+pub struct AggrEntry {
+    pub pc: u64,
+    pub hits: u64,
+    /// the accessed address of the first hit.
+    pub first_addr: u64,
+    pub last_tid: i32,
+    _reserved: u32,
+    /// x0-x30, sp, pc and pstate of the last hit.
+    pub regs: [u64; 34],
+}
+
+/// the most frames of a call stack collected by `Breakpoint::set_stacks`.
+pub const STACK_MAX_DEPTH: usize = 32;
+
+/// a row of the table of a stack collecting breakpoint, one per unique call stack.
+#[repr(C)]
+#[derive(Debug, Clone)]
+pub struct StackEntry {
+    pub hits: u64,
+    depth: u32,
+    pub last_tid: i32,
+    /// the accessed address of the first hit.
+    pub first_addr: u64,
+    frames: [u64; STACK_MAX_DEPTH],
+}
+
+impl StackEntry {
+    /// the pc of the hit followed by the return addresses, innermost first. The second frame
+    /// is the link register when it is not the return address of the first frame record,
+    /// as in a leaf function.
+    pub fn frames(&self) -> &[u64] {
+        &self.frames[..self.depth as usize]
+    }
+}
+
+/// usage of the pool of stop tasks of a breakpoint.
+#[repr(C)]
+#[derive(Debug, Clone, Default)]
+pub struct PoolStats {
+    pub size: u32,
+    /// threads which are stopped or about to stop.
+    pub in_use: u32,
+    /// stops which were dropped because the pool was empty.
+    pub exhausted: u64,
+}
+
+/// comparison of a `CondTerm`, the operand masked with `mask` is compared with `value`.
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum CondOp {
+    Eq = 0,
+    Ne = 1,
+    Lt = 2,
+    Le = 3,
+    Gt = 4,
+    Ge = 5,
+    SignedLt = 6,
+    SignedLe = 7,
+    SignedGt = 8,
+    SignedGe = 9,
+    /// true if `operand & mask & value` is not zero.
+    Test = 10,
+}
+
+/// a term of a breakpoint condition, evaluated in the kernel at hit time.
+#[repr(C)]
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct CondTerm {
+    /// register id, or `REG_ACCESS_ADDR`.
+    pub reg: u32,
+    /// 0 to compare the register itself, else 1/2/4/8 bytes read at `reg + offset`.
+    pub deref_size: u8,
+    pub op: CondOp,
+    _reserved: u16,
+    pub offset: i64,
+    pub mask: u64,
+    pub value: u64,
+}
+
+impl CondTerm {
+    /// `reg & mask <op> value`
+    pub fn reg(reg: u32, op: CondOp, value: u64) -> Self {
+        Self {
+            reg,
+            deref_size: 0,
+            op,
+            _reserved: 0,
+            offset: 0,
+            mask: u64::MAX,
+            value,
+        }
+    }
+
+    /// `*(reg + offset) & mask <op> value`, reading `size` bytes.
+    pub fn mem(reg: u32, offset: i64, size: u8, op: CondOp, value: u64) -> Self {
+        Self {
+            reg,
+            deref_size: size,
+            op,
+            _reserved: 0,
+            offset,
+            mask: u64::MAX,
+            value,
+        }
+    }
+
+    pub fn with_mask(mut self, mask: u64) -> Self {
+        self.mask = mask;
+        self
+    }
+}
+
+/// an action run in the kernel at every hit of a breakpoint in action mode.
+#[repr(C)]
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Action {
+    op: u8,
+    reg: u8,
+    len: u8,
+    _reserved: [u8; 5],
+    offset: i64,
+    value: u64,
+}
+
+impl Action {
+    fn new(op: u8, reg: u8, len: u8, offset: i64, value: u64) -> Self {
+        Self {
+            op,
+            reg,
+            len,
+            _reserved: [0; 5],
+            offset,
+            value,
+        }
+    }
+
+    /// `reg = value`, for x0-x30, sp and pc.
+    pub fn set_reg(reg: u8, value: u64) -> Self {
+        Self::new(0, reg, 0, 0, value)
+    }
+
+    /// `reg += value`, wrapping.
+    pub fn add_reg(reg: u8, value: u64) -> Self {
+        Self::new(1, reg, 0, 0, value)
+    }
+
+    /// write the low `len` (1-8) bytes of `value` at `reg + offset`, `reg` may be
+    /// `REG_ACCESS_ADDR`.
+    pub fn write_mem(reg: u8, offset: i64, len: u8, value: u64) -> Self {
+        Self::new(2, reg, len, offset, value)
+    }
+
+    /// `pc = reg + offset`, e.g. `redirect(30, 0)` returns from a function at its
+    /// first instruction.
+    pub fn redirect(reg: u8, offset: i64) -> Self {
+        Self::new(3, reg, 0, offset, 0)
+    }
+
+    /// `pc = target`.
+    pub fn jump(target: u64) -> Self {
+        Self::new(3, 0xff, 0, target as i64, 0)
+    }
+}
+
+/// a hit recorded by a logpoint.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct LogRecord {
+    /// CLOCK_MONOTONIC time of the hit in nanoseconds.
+    pub time: u64,
+    pub tid: i32,
+    pub pc: u64,
+    pub addr: u64,
+    /// the registers selected in `LogConfig::reg_mask`, in ascending order.
+    pub regs: Vec<u64>,
+    /// the recorded memory, truncated to the readable part.
+    pub mem: Vec<u8>,
+    /// the memory after the instruction for `LOG_NEW_VALUE`, empty otherwise.
+    pub new_mem: Vec<u8>,
+}
+
+impl LogRecord {
+    pub fn parse(buf: &[u8], config: &LogConfig) -> Result<Self> {
+        let mut cursor = Cursor::new(buf);
+        let time = cursor.read_u64::<NativeEndian>()?;
+        let tid = cursor.read_i32::<NativeEndian>()?;
+        let mem_valid = cursor.read_u32::<NativeEndian>()?;
+        let pc = cursor.read_u64::<NativeEndian>()?;
+        let addr = cursor.read_u64::<NativeEndian>()?;
+        let mut regs = Vec::with_capacity(config.reg_mask.count_ones() as usize);
+        for _ in 0..config.reg_mask.count_ones() {
+            regs.push(cursor.read_u64::<NativeEndian>()?);
+        }
+        let mut mem = vec![0u8; config.mem_len as usize];
+        cursor.read_exact(&mut mem)?;
+        mem.truncate(mem_valid as usize);
+        let mut new_mem = Vec::new();
+        if config.flags & LOG_NEW_VALUE != 0 {
+            new_mem.resize(config.mem_len as usize, 0);
+            cursor.read_exact(&mut new_mem)?;
+            new_mem.truncate(mem_valid as usize);
+        }
+        Ok(Self {
+            time,
+            tid,
+            pc,
+            addr,
+            regs,
+            mem,
+            new_mem,
+        })
+    }
+}
+
+/// a ring buffer shared with the kernel module.
+#[derive(Debug)]
+pub struct Ring {
+    ptr: *mut u8,
+    len: usize,
+}
+
+unsafe impl Send for Ring {}
+
+impl Ring {
+    const PAGE_SIZE: usize = 0x1000;
+
+    fn map(fd: RawFd, pages: u32, offset: i64) -> Result<Self> {
+        let len = (pages as usize + 1) * Self::PAGE_SIZE;
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                fd,
+                offset,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(nix::errno::Errno::last().into());
+        }
+        Ok(Self {
+            ptr: ptr as *mut u8,
+            len,
+        })
+    }
+
+    fn head(&self) -> &AtomicU64 {
+        unsafe { &*(self.ptr as *const AtomicU64) }
+    }
+
+    fn tail(&self) -> &AtomicU64 {
+        unsafe { &*(self.ptr.add(8) as *const AtomicU64) }
+    }
+
+    /// records dropped because the ring was full.
+    pub fn lost(&self) -> u64 {
+        unsafe { std::ptr::read_volatile(self.ptr.add(16) as *const u64) }
+    }
+
+    fn record_size(&self) -> usize {
+        unsafe { std::ptr::read_volatile(self.ptr.add(24) as *const u32) as usize }
+    }
+
+    fn data_size(&self) -> usize {
+        unsafe { std::ptr::read_volatile(self.ptr.add(28) as *const u32) as usize }
+    }
+
+    /// take the oldest raw record out of the ring.
+    pub fn pop(&mut self) -> Option<Vec<u8>> {
+        let head = self.head().load(Ordering::Acquire);
+        let tail = self.tail().load(Ordering::Relaxed);
+        if head == tail {
+            return None;
+        }
+        let record_size = self.record_size();
+        let data_size = self.data_size();
+        let data = unsafe {
+            std::slice::from_raw_parts(self.ptr.add(Self::PAGE_SIZE), self.len - Self::PAGE_SIZE)
+        };
+        let off = (tail as usize) & (data_size - 1);
+        let first = std::cmp::min(record_size, data_size - off);
+        let mut record = Vec::with_capacity(record_size);
+        record.extend_from_slice(&data[off..off + first]);
+        record.extend_from_slice(&data[..record_size - first]);
+        self.tail()
+            .store(tail + record_size as u64, Ordering::Release);
+        Some(record)
+    }
+}
+
+impl Drop for Ring {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.len);
+        }
+    }
+}
+
+/// the register page of a breakpoint, see `Breakpoint::map_regs`.
+#[derive(Debug)]
+pub struct RegsPage {
+    ptr: *mut u8,
+}
+
+unsafe impl Send for RegsPage {}
+
+impl RegsPage {
+    const REGS_OFFSET: usize = 16;
+    const SIMD_OFFSET: usize = Self::REGS_OFFSET + std::mem::size_of::<Regs>();
+    const DIRTY_GPR: u32 = 0x1;
+    const DIRTY_SIMD: u32 = 0x2;
+
+    fn map(fd: RawFd) -> Result<Self> {
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                Ring::PAGE_SIZE,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                fd,
+                Ring::PAGE_SIZE as i64,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(nix::errno::Errno::last().into());
+        }
+        Ok(Self {
+            ptr: ptr as *mut u8,
+        })
+    }
+
+    /// incremented every time a thread stops.
+    pub fn seq(&self) -> u32 {
+        unsafe { std::ptr::read_volatile(self.ptr as *const u32) }
+    }
+
+    /// the thread which stopped last.
+    pub fn tid(&self) -> i32 {
+        unsafe { std::ptr::read_volatile(self.ptr.add(4) as *const i32) }
+    }
+
+    fn mark_dirty(&self, flag: u32) {
+        let dirty = self.ptr.wrapping_add(8) as *mut u32;
+        unsafe { std::ptr::write_volatile(dirty, std::ptr::read_volatile(dirty) | flag) };
+    }
+
+    pub fn regs(&self) -> Regs {
+        unsafe { std::ptr::read_volatile(self.ptr.add(Self::REGS_OFFSET) as *const Regs) }
+    }
+
+    pub fn simd_regs(&self) -> SimdRegs {
+        unsafe { std::ptr::read_volatile(self.ptr.add(Self::SIMD_OFFSET) as *const SimdRegs) }
+    }
+
+    /// replace the registers, they are applied when the thread continues.
+    pub fn set_regs(&self, regs: &Regs) {
+        unsafe {
+            std::ptr::write_volatile(self.ptr.add(Self::REGS_OFFSET) as *mut Regs, regs.clone())
+        };
+        self.mark_dirty(Self::DIRTY_GPR);
+    }
+
+    /// set x0-x30, sp, pc or pstate by id, applied when the thread continues.
+    pub fn set_reg(&self, reg: u8, value: u64) -> Result<()> {
+        if reg >= 34 {
+            return Err(errors::Error::InvalidRegister(reg as u64));
+        }
+        unsafe {
+            std::ptr::write_volatile(
+                (self.ptr.add(Self::REGS_OFFSET) as *mut u64).add(reg as usize),
+                value,
+            )
+        };
+        self.mark_dirty(Self::DIRTY_GPR);
+        Ok(())
+    }
+
+    /// replace the simd registers, they are applied when the thread continues.
+    pub fn set_simd_regs(&self, regs: &SimdRegs) {
+        unsafe {
+            std::ptr::write_volatile(
+                self.ptr.add(Self::SIMD_OFFSET) as *mut SimdRegs,
+                regs.clone(),
+            )
+        };
+        self.mark_dirty(Self::DIRTY_SIMD);
+    }
+}
+
+impl Drop for RegsPage {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, Ring::PAGE_SIZE);
+        }
+    }
+}
+
+/// a breakpoint of `Device::add_bps`.
+#[derive(Debug, Clone)]
+pub struct BpSpec {
+    pub pid: i32,
+    pub bp_type: BreakpointType,
+    /// 1, 2, 4 or 8, ignored for a range.
+    pub len: u8,
+    pub addr: u64,
+    /// watch `[addr, addr + range_len)` like `Device::add_bp_range` if not 0.
+    pub range_len: u64,
+    /// `BP_FLAG_DISABLED` and `BP_FLAG_PROCESS`.
+    pub flags: u8,
+}
+
+/// an event of a `BpQueue`.
+#[repr(C)]
+#[derive(Debug, Clone)]
+pub struct BpEvent {
+    /// the id given to `Breakpoint::set_queue`.
+    pub id: u64,
+    pub time: u64,
+    pub tid: i32,
+    /// 0 for a hit, 1 for a stop.
+    pub event_type: u32,
+    pub pc: u64,
+    /// the accessed address, 0 for a stop.
+    pub addr: u64,
+    /// x0-x30, sp, pc and pstate.
+    pub regs: [u64; 34],
+}
+
+#[repr(C)]
+#[derive(Debug, Clone, Default)]
+pub struct BpQueueStats {
+    pub capacity: u32,
+    pub pending: u32,
+    /// events which were dropped because the queue was full.
+    pub lost: u64,
+}
+
+/// a queue of the events of many breakpoints, it can be polled through its fd.
+#[derive(Debug)]
+pub struct BpQueue {
+    fd: OwnedFd,
+}
+
+impl AsRawFd for BpQueue {
+    fn as_raw_fd(&self) -> RawFd {
+        self.fd.as_raw_fd()
+    }
+}
+
+impl BpQueue {
+    /// read up to `max_events` events, blocks until there is at least one.
+    pub fn read_events(&self, max_events: usize) -> Result<Vec<BpEvent>> {
+        let event_size = std::mem::size_of::<BpEvent>();
+        let mut buf = vec![0u8; max_events * event_size];
+        let size = nix::unistd::read(self.fd.as_raw_fd(), &mut buf)?;
+        let events = buf[..size - size % event_size]
+            .chunks_exact(event_size)
+            .map(|event| unsafe { std::ptr::read_unaligned(event.as_ptr() as *const BpEvent) })
+            .collect();
+        Ok(events)
+    }
+
+    pub fn stats(&self) -> Result<BpQueueStats> {
+        ioctl_read!(bp_queue_get_stats, RWMEM_BP_QUEUE_MAGIC, 0, BpQueueStats);
+        let mut stats = BpQueueStats::default();
+        unsafe { bp_queue_get_stats(self.fd.as_raw_fd(), &mut stats) }?;
+        Ok(stats)
+    }
+}
+
+/// a thread of `Device::snapshot_threads`.
+#[derive(Debug, Clone)]
+pub struct ThreadSnapshot {
+    pub tid: i32,
+    /// the thread was on a cpu, so `regs` may be stale.
+    pub running: bool,
+    pub regs: Regs,
+    /// the stack from sp, truncated to the readable part.
+    pub stack: Vec<u8>,
+}
+
+/// interrupt the threads sleeping in a syscall so they park at once, like a signal.
+pub const FREEZE_INTERRUPT: u32 = 0x1;
+
+#[repr(C)]
+#[derive(Debug, Clone, Default)]
+pub struct FreezeState {
+    /// threads asked to park.
+    pub threads: u32,
+    /// threads parked now.
+    pub parked: u32,
+    /// threads which exited before they parked.
+    pub exited: u32,
+    /// nonzero once the timeout has thawed the threads.
+    pub timed_out: u32,
+}
+
+/// a frozen process, created by `Device::freeze`. Dropping it thaws the threads.
+#[derive(Debug)]
+pub struct Freeze {
+    fd: OwnedFd,
+}
+
+impl AsRawFd for Freeze {
+    fn as_raw_fd(&self) -> RawFd {
+        self.fd.as_raw_fd()
+    }
+}
+
+impl Freeze {
+    /// wait up to `timeout_ms` for every thread to park. Fails with `ETIMEDOUT` if some
+    /// are still running, and with `ECANCELED` if the freeze is over.
+    pub fn wait(&self, timeout_ms: u32) -> Result<()> {
+        nix::errno::Errno::result(unsafe {
+            libc::ioctl(
+                self.fd.as_raw_fd(),
+                request_code_none!(RWMEM_FREEZE_MAGIC, 0),
+                timeout_ms as libc::c_ulong,
+            )
+        })?;
+        Ok(())
+    }
+
+    pub fn state(&self) -> Result<FreezeState> {
+        ioctl_read!(freeze_get_state, RWMEM_FREEZE_MAGIC, 1, FreezeState);
+        let mut state = FreezeState::default();
+        unsafe { freeze_get_state(self.fd.as_raw_fd(), &mut state) }?;
+        Ok(state)
+    }
+
+    /// resume all threads, the fd stays valid for `state`.
+    pub fn thaw(&self) -> Result<()> {
+        ioctl_none!(freeze_thaw, RWMEM_FREEZE_MAGIC, 2);
+        unsafe { freeze_thaw(self.fd.as_raw_fd()) }?;
+        Ok(())
+    }
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct StepParam {
+    mode: u32,
+    flags: u32,
+    count: u64,
+    start: u64,
+    end: u64,
+}
+
+/// a register write of `Breakpoint::resume`, ids are those of `set_reg` and
+/// `set_simd_reg`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RegWrite {
+    Gpr(u8, u64),
+    Simd(u8, u128),
+}
+
+#[repr(C)]
+struct RegWriteParam {
+    kind: u32,
+    id: u32,
+    _reserved: u64,
+    value: u128,
+}
+
+#[repr(C)]
+struct ResumeParam {
+    writes: u64,
+    count: u32,
+    action: u32,
+    step: StepParam,
+}
+
+#[repr(C)]
+struct ModifyParam {
+    bp_type: u8,
+    flags: u8,
+    _reserved: u16,
+    len: u32,
+    addr: u64,
+    range_len: u64,
+}
+
+#[repr(C)]
+struct BpQueueParam {
+    fd: i32,
+    flags: u32,
+    id: u64,
+}
+
 #[allow(dead_code)]
 impl Breakpoint {
     pub fn from_raw_fd(fd: RawFd) -> Self {
@@ -432,9 +1387,355 @@ impl Breakpoint {
         Ok(num)
     }
 
+    fn step_ex(&self, mode: u32, flags: u32, count: u64, start: u64, end: u64) -> Result<()> {
+        ioctl_write_ptr!(bp_step_ex, RWMEM_BP_MAGIC, 12, StepParam);
+        let param = StepParam {
+            mode,
+            flags,
+            count,
+            start,
+            end,
+        };
+        unsafe { bp_step_ex(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// step `count` instructions, the thread stops only after the last one.
+    pub fn step_n(&self, count: u64) -> Result<()> {
+        self.step_ex(0, 0, count, 0, 0)
+    }
+
+    /// step until the pc is in `[start, end)`, or at most `max_steps` instructions
+    /// (0 for no limit).
+    pub fn step_until(&self, start: u64, end: u64, max_steps: u64) -> Result<()> {
+        self.step_ex(1, 0, max_steps, start, end)
+    }
+
+    /// step until the current function returns to the lr of the stop, or at most
+    /// `max_steps` instructions (0 for no limit).
+    pub fn step_out(&self, max_steps: u64) -> Result<()> {
+        self.step_ex(2, 0, max_steps, 0, 0)
+    }
+
+    /// allocate the ring buffer of `trace`, the breakpoint keeps stopping on hits.
+    /// The ring can be mapped with `map_log`.
+    pub fn set_trace(&self, config: &LogConfig) -> Result<()> {
+        ioctl_write_ptr!(bp_set_trace, RWMEM_BP_MAGIC, 13, LogConfig);
+        unsafe { bp_set_trace(self.fd.as_raw_fd(), config) }?;
+        Ok(())
+    }
+
+    /// step while the pc is in `[start, end)`, or at most `max_steps` instructions (0 for
+    /// no limit), and record the registers after every instruction into the ring set by
+    /// `set_trace`. The thread stops after the last instruction.
+    pub fn trace(&self, start: u64, end: u64, max_steps: u64) -> Result<()> {
+        self.step_ex(3, 1, max_steps, start, end)
+    }
+
     pub fn is_stopped(&self) -> Result<bool> {
         ioctl_none!(bp_is_stopped, RWMEM_BP_MAGIC, 4);
         let stopped = unsafe { bp_is_stopped(self.fd.as_raw_fd()) }?;
         Ok(stopped != 0)
     }
+
+    /// tid of the stopped thread, `None` if no thread is stopped.
+    pub fn stopped_tid(&self) -> Result<Option<i32>> {
+        ioctl_none!(bp_is_stopped, RWMEM_BP_MAGIC, 4);
+        let tid = unsafe { bp_is_stopped(self.fd.as_raw_fd()) }?;
+        Ok(if tid != 0 { Some(tid) } else { None })
+    }
+
+    /// disarm the breakpoint without closing it, `enable` arms it again.
+    pub fn disable(&self) -> Result<()> {
+        ioctl_none!(bp_disable, RWMEM_BP_MAGIC, 18);
+        unsafe { bp_disable(self.fd.as_raw_fd()) }?;
+        Ok(())
+    }
+
+    /// move a hardware breakpoint to a new address, length and type in place. Only
+    /// `BP_FLAG_DISABLED` is honored in `flags`.
+    pub fn modify(&self, bp_type: BreakpointType, len: u8, addr: u64, flags: u8) -> Result<()> {
+        self.modify_ex(bp_type, len as u32, addr, 0, flags & BP_FLAG_DISABLED)
+    }
+
+    /// move a hardware watchpoint to `[addr, addr + len)`, see `Device::add_bp_range`.
+    pub fn modify_range(
+        &self,
+        bp_type: BreakpointType,
+        addr: u64,
+        len: u64,
+        flags: u8,
+    ) -> Result<()> {
+        self.modify_ex(
+            bp_type,
+            0,
+            addr,
+            len,
+            (flags & BP_FLAG_DISABLED) | BP_FLAG_RANGE,
+        )
+    }
+
+    fn modify_ex(
+        &self,
+        bp_type: BreakpointType,
+        len: u32,
+        addr: u64,
+        range_len: u64,
+        flags: u8,
+    ) -> Result<()> {
+        ioctl_write_ptr!(bp_modify, RWMEM_BP_MAGIC, 19, ModifyParam);
+        let param = ModifyParam {
+            bp_type: match bp_type {
+                BreakpointType::Read => 1,
+                BreakpointType::Write => 2,
+                BreakpointType::ReadWrite => 3,
+                BreakpointType::Execute => 4,
+            },
+            flags,
+            _reserved: 0,
+            len,
+            addr,
+            range_len,
+        };
+        unsafe { bp_modify(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// arm a breakpoint created with `BP_FLAG_DISABLED`.
+    pub fn enable(&self) -> Result<()> {
+        ioctl_none!(bp_enable, RWMEM_BP_MAGIC, 5);
+        unsafe { bp_enable(self.fd.as_raw_fd()) }?;
+        Ok(())
+    }
+
+    /// turn the breakpoint into a logpoint, which records every hit into a ring buffer
+    /// instead of stopping the thread. The ring can be mapped with `map_log`.
+    pub fn set_log(&self, config: &LogConfig) -> Result<()> {
+        ioctl_write_ptr!(bp_set_log, RWMEM_BP_MAGIC, 6, LogConfig);
+        unsafe { bp_set_log(self.fd.as_raw_fd(), config) }?;
+        Ok(())
+    }
+
+    /// only handle hits for which all terms (or any term if `any` is set) are true.
+    /// An empty slice removes the condition.
+    pub fn set_cond(&self, terms: &[CondTerm], any: bool) -> Result<()> {
+        #[repr(C)]
+        struct SetCondParam {
+            count: u32,
+            flags: u32,
+            terms: u64,
+        }
+        ioctl_write_ptr!(bp_set_cond, RWMEM_BP_MAGIC, 7, SetCondParam);
+        let param = SetCondParam {
+            count: terms.len() as u32,
+            flags: any as u32,
+            terms: terms.as_ptr() as u64,
+        };
+        unsafe { bp_set_cond(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// run `actions` in order at every hit instead of stopping the thread. An empty
+    /// slice returns to stopping. Fails for logpoints and aggregating breakpoints.
+    pub fn set_actions(&self, actions: &[Action]) -> Result<()> {
+        #[repr(C)]
+        struct SetActionsParam {
+            count: u32,
+            flags: u32,
+            actions: u64,
+        }
+        ioctl_write_ptr!(bp_set_actions, RWMEM_BP_MAGIC, 17, SetActionsParam);
+        let param = SetActionsParam {
+            count: actions.len() as u32,
+            flags: 0,
+            actions: actions.as_ptr() as u64,
+        };
+        unsafe { bp_set_actions(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// skip the first `ignore_count` hits, then only handle every `every_n`th hit
+    /// (0 or 1 for all). This resets the hit counter.
+    pub fn set_hit_policy(&self, ignore_count: u64, every_n: u64) -> Result<()> {
+        #[repr(C)]
+        struct HitPolicy {
+            ignore_count: u64,
+            every_n: u64,
+        }
+        ioctl_write_ptr!(bp_set_hit_policy, RWMEM_BP_MAGIC, 8, HitPolicy);
+        let param = HitPolicy {
+            ignore_count,
+            every_n,
+        };
+        unsafe { bp_set_hit_policy(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// the number of hits that passed the condition, read without stopping the thread.
+    pub fn hit_count(&self) -> Result<u64> {
+        ioctl_read!(bp_get_hit_count, RWMEM_BP_MAGIC, 9, u64);
+        let mut hits = 0u64;
+        unsafe { bp_get_hit_count(self.fd.as_raw_fd(), &mut hits) }?;
+        Ok(hits)
+    }
+
+    /// turn the breakpoint into an aggregating one, which never stops the thread and
+    /// counts the hits per unique pc in a table of `capacity` entries instead.
+    pub fn set_aggregate(&self, capacity: u32) -> Result<()> {
+        ioctl_write_ptr!(bp_set_aggr, RWMEM_BP_MAGIC, 10, u32);
+        unsafe { bp_set_aggr(self.fd.as_raw_fd(), &capacity) }?;
+        Ok(())
+    }
+
+    /// read up to `max_entries` rows of the table of an aggregating breakpoint, and
+    /// empty it if `reset` is set. Also returns the hits of pcs which did not fit. A reset
+    /// fails with ENOSPC, leaving the table alone, when its rows do not fit into `max_entries`.
+    pub fn read_aggregate(&self, max_entries: usize, reset: bool) -> Result<(Vec<AggrEntry>, u64)> {
+        #[repr(C)]
+        struct ReadAggrParam {
+            entries: u64,
+            max_entries: u32,
+            flags: u32,
+            dropped: u64,
+        }
+        ioctl_readwrite!(bp_read_aggr, RWMEM_BP_MAGIC, 11, ReadAggrParam);
+        let mut entries: Vec<AggrEntry> = Vec::with_capacity(max_entries);
+        let mut param = ReadAggrParam {
+            entries: entries.as_mut_ptr() as u64,
+            max_entries: max_entries as u32,
+            flags: reset as u32,
+            dropped: 0,
+        };
+        let copied = unsafe { bp_read_aggr(self.fd.as_raw_fd(), &mut param) }?;
+        unsafe { entries.set_len(copied as usize) };
+        Ok((entries, param.dropped))
+    }
+
+    /// turn the breakpoint into one which never stops the thread and counts the hits per
+    /// unique user call stack of up to `depth` frames, in a table of `capacity` entries.
+    /// The stacks are found by following the frame pointers of the thread.
+    pub fn set_stacks(&self, capacity: u32, depth: u32) -> Result<()> {
+        #[repr(C)]
+        struct StackParam {
+            capacity: u32,
+            depth: u32,
+        }
+        ioctl_write_ptr!(bp_set_stacks, RWMEM_BP_MAGIC, 20, StackParam);
+        let param = StackParam { capacity, depth };
+        unsafe { bp_set_stacks(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// read up to `max_entries` rows of the stack table, and empty it if `reset` is set.
+    /// Also returns the hits of stacks which did not fit. A reset fails with ENOSPC, leaving
+    /// the table alone, when its rows do not fit into `max_entries`.
+    pub fn read_stacks(&self, max_entries: usize, reset: bool) -> Result<(Vec<StackEntry>, u64)> {
+        #[repr(C)]
+        struct ReadStacksParam {
+            entries: u64,
+            max_entries: u32,
+            flags: u32,
+            dropped: u64,
+        }
+        ioctl_readwrite!(bp_read_stacks, RWMEM_BP_MAGIC, 21, ReadStacksParam);
+        let mut entries: Vec<StackEntry> = Vec::with_capacity(max_entries);
+        let mut param = ReadStacksParam {
+            entries: entries.as_mut_ptr() as u64,
+            max_entries: max_entries as u32,
+            flags: reset as u32,
+            dropped: 0,
+        };
+        let copied = unsafe { bp_read_stacks(self.fd.as_raw_fd(), &mut param) }?;
+        unsafe { entries.set_len(copied as usize) };
+        Ok((entries, param.dropped))
+    }
+
+    /// usage of the preallocated stop tasks, a nonzero `exhausted` means hits were lost.
+    pub fn pool_stats(&self) -> Result<PoolStats> {
+        ioctl_read!(bp_get_pool_stats, RWMEM_BP_MAGIC, 14, PoolStats);
+        let mut stats = PoolStats::default();
+        unsafe { bp_get_pool_stats(self.fd.as_raw_fd(), &mut stats) }?;
+        Ok(stats)
+    }
+
+    /// report the events selected by `flags` (`QUEUE_HITS`, `QUEUE_STOPS`) to `queue`,
+    /// tagged with `id`. This replaces the previous queue of the breakpoint.
+    pub fn set_queue(&self, queue: &BpQueue, id: u64, flags: u32) -> Result<()> {
+        ioctl_write_ptr!(bp_set_queue, RWMEM_BP_MAGIC, 15, BpQueueParam);
+        let param = BpQueueParam {
+            fd: queue.as_raw_fd(),
+            flags,
+            id,
+        };
+        unsafe { bp_set_queue(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// stop reporting to the queue.
+    pub fn clear_queue(&self) -> Result<()> {
+        ioctl_write_ptr!(bp_set_queue, RWMEM_BP_MAGIC, 15, BpQueueParam);
+        let param = BpQueueParam {
+            fd: -1,
+            flags: 0,
+            id: 0,
+        };
+        unsafe { bp_set_queue(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// write registers of the stopped thread and continue it, in one syscall. Nothing
+    /// is written if any of the writes is invalid.
+    pub fn resume(&self, writes: &[RegWrite]) -> Result<()> {
+        self.resume_ex(writes, 0, StepParam::default())
+    }
+
+    /// write registers of the stopped thread and step `count` instructions.
+    pub fn resume_step(&self, writes: &[RegWrite], count: u64) -> Result<()> {
+        let step = StepParam {
+            count,
+            ..Default::default()
+        };
+        self.resume_ex(writes, 1, step)
+    }
+
+    fn resume_ex(&self, writes: &[RegWrite], action: u32, step: StepParam) -> Result<()> {
+        ioctl_write_ptr!(bp_resume, RWMEM_BP_MAGIC, 16, ResumeParam);
+        let writes: Vec<RegWriteParam> = writes
+            .iter()
+            .map(|w| match *w {
+                RegWrite::Gpr(id, value) => RegWriteParam {
+                    kind: 0,
+                    id: id as u32,
+                    _reserved: 0,
+                    value: value as u128,
+                },
+                RegWrite::Simd(id, value) => RegWriteParam {
+                    kind: 1,
+                    id: id as u32,
+                    _reserved: 0,
+                    value,
+                },
+            })
+            .collect();
+        let param = ResumeParam {
+            writes: writes.as_ptr() as u64,
+            count: writes.len() as u32,
+            action,
+            step,
+        };
+        unsafe { bp_resume(self.fd.as_raw_fd(), &param) }?;
+        Ok(())
+    }
+
+    /// map the page which holds the registers of the stopped thread. It is filled
+    /// before the stop is signalled, and changes marked by its setters are applied
+    /// by `cont`, so a stop can be inspected and patched without more syscalls.
+    pub fn map_regs(&self) -> Result<RegsPage> {
+        RegsPage::map(self.fd.as_raw_fd())
+    }
+
+    /// map the ring buffer of a logpoint, records can be parsed with `LogRecord::parse`.
+    pub fn map_log(&self, config: &LogConfig) -> Result<Ring> {
+        Ring::map(self.fd.as_raw_fd(), config.ring_pages, 0)
+    }
 }
@@ -2,43 +2,262 @@
 #include "api_proxy.h"
 #include "asm/current.h"
 #include "asm/debug-monitors.h"
+#include "asm/fpsimd.h"
 #include "asm/processor.h"
 #include "asm/ptrace.h"
+#include "bp_ring.h"
 #include "linux/anon_inodes.h"
 #include "linux/atomic/atomic-instrumented.h"
+#include "linux/bitmap.h"
 #include "linux/file.h"
+#include "linux/hashtable.h"
 #include "linux/hw_breakpoint.h"
+#include "linux/ktime.h"
+#include "linux/mm.h"
 #include "linux/poll.h"
+#include "linux/refcount.h"
+#include "linux/rcupdate.h"
+#include "linux/sched/signal.h"
 #include "linux/spinlock.h"
 #include "linux/spinlock_types.h"
 #include "linux/task_work.h"
 #include "linux/types.h"
+#include "linux/version.h"
+#include "linux/vmalloc.h"
 #include "linux/wait.h"
+#include "rwmem_trace.h"
+#include "stats.h"
+#include "swbp.h"
+#include "swwp.h"
+#include "ver_control.h"
 
-struct hit_bp_cb {
-	struct callback_head twork;
-	struct file *file;
-};
 
-DEFINE_SPINLOCK(step_list_lock);
-LIST_HEAD(step_list);
+// Threads which single step, keyed by pid. The step exception looks its
+// entry up under rcu only, the bucket locks serialize the writers.
+#define RWMEM_BP_STEP_HASH_BITS 6
+// most threads which can step at the same time
+#define RWMEM_BP_STEP_POOL_SIZE 256
 
-struct step_list_entry {
-	struct list_head list;
+struct step_entry {
+	struct hlist_node node;
+	struct rcu_head rcu;
 	pid_t pid;
-	struct file *file;
-	bool removed;
+	struct rwmem_bp_private_data *data; // holds a reference
+	uint32_t mode; // RWMEM_BP_STEP_*
+	uint32_t flags;
+	uint64_t remaining; // instructions left to step
+	unsigned long start; // the pc range of RWMEM_BP_STEP_UNTIL
+	unsigned long end;
+	unsigned long ret_addr; // the lr and sp of RWMEM_BP_STEP_OUT
+	unsigned long ret_sp;
+};
+
+static DEFINE_HASHTABLE(step_table, RWMEM_BP_STEP_HASH_BITS);
+static spinlock_t step_table_lock[1 << RWMEM_BP_STEP_HASH_BITS] = {
+	[0 ... (1 << RWMEM_BP_STEP_HASH_BITS) - 1] =
+		__SPIN_LOCK_UNLOCKED(step_table_lock),
 };
+static struct step_entry step_pool[RWMEM_BP_STEP_POOL_SIZE];
+static DECLARE_BITMAP(step_pool_used, RWMEM_BP_STEP_POOL_SIZE);
+
+static struct step_entry *step_entry_alloc(void)
+{
+	unsigned int i = 0;
+
+	while ((i = find_next_zero_bit(step_pool_used, RWMEM_BP_STEP_POOL_SIZE,
+				       i)) < RWMEM_BP_STEP_POOL_SIZE) {
+		if (!test_and_set_bit_lock(i, step_pool_used)) {
+			memset(&step_pool[i], 0, sizeof(step_pool[i]));
+			return &step_pool[i];
+		}
+	}
+	return NULL;
+}
+
+static void step_entry_free_rcu(struct rcu_head *rcu)
+{
+	struct step_entry *entry = container_of(rcu, struct step_entry, rcu);
+
+	clear_bit_unlock(entry - step_pool, step_pool_used);
+}
+
+// The entry may still be walked by lookups in the same bucket, it is reused
+// after a grace period only
+static void step_entry_free(struct step_entry *entry)
+{
+	call_rcu(&entry->rcu, step_entry_free_rcu);
+}
+
+static spinlock_t *step_bucket_lock(pid_t pid)
+{
+	return &step_table_lock[hash_min(pid, RWMEM_BP_STEP_HASH_BITS)];
+}
+
+static struct step_entry *step_entry_find(pid_t pid)
+{
+	struct step_entry *entry;
+
+	hash_for_each_possible_rcu (step_table, entry, node, pid) {
+		if (entry->pid == pid) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+void rwmem_bp_put(struct rwmem_bp_private_data *data)
+{
+	if (!refcount_dec_and_test(&data->ref)) {
+		return;
+	}
+	if (data->target_task) {
+		put_task_struct(data->target_task);
+	}
+	rwmem_ring_free(data->ring);
+	vfree(data->regs_page);
+	rwmem_bp_aggr_free(data->aggr);
+	rwmem_bp_stacks_free(data->stacks);
+	if (rcu_access_pointer(data->cond)) {
+		kfree_rcu(rcu_dereference_protected(data->cond, 1), rcu);
+	}
+	if (rcu_access_pointer(data->actions)) {
+		kfree_rcu(rcu_dereference_protected(data->actions, 1), rcu);
+	}
+	rwmem_bp_queue_link_free(rcu_dereference_protected(data->queue, 1));
+	kfree(data->events);
+	kfree(data);
+}
+
+// Returns the stopped thread with a reference held, NULL if none is stopped
+static struct task_struct *
+bp_get_stopped_task(struct rwmem_bp_private_data *data)
+{
+	struct task_struct *task = NULL;
+
+	spin_lock(&data->flag_lock);
+	if (data->stopped_flag && data->stopped_task) {
+		task = data->stopped_task;
+		get_task_struct(task);
+	}
+	spin_unlock(&data->flag_lock);
+	return task;
+}
+
+// Take a resume task from the pool of the bp, it holds a reference to the
+// bp until it is put back. Safe in exception context.
+static struct hit_bp_cb *hit_cb_get(struct rwmem_bp_private_data *data)
+{
+	unsigned int i = 0;
+
+	while ((i = find_next_zero_bit(data->hit_pool_used,
+				       RWMEM_BP_HIT_POOL_SIZE, i)) <
+	       RWMEM_BP_HIT_POOL_SIZE) {
+		if (!test_and_set_bit_lock(i, data->hit_pool_used)) {
+			refcount_inc(&data->ref);
+			data->hit_pool[i].data = data;
+			return &data->hit_pool[i];
+		}
+	}
+	atomic64_inc(&data->hit_pool_exhausted);
+	return NULL;
+}
+
+// Put the resume task back, the caller still has to drop the reference
+static void hit_cb_put(struct hit_bp_cb *twcb)
+{
+	struct rwmem_bp_private_data *data = twcb->data;
+
+	clear_bit_unlock(twcb - data->hit_pool, data->hit_pool_used);
+}
+
+// Snapshot the registers of a stopped task, or of current with its fpsimd
+// state saved
+static void bp_regs_fill(struct rwmem_bp_regs_page *page,
+			 struct task_struct *task)
+{
+	page->tid = task->pid;
+	page->dirty = 0;
+	memcpy(&page->regs, &task_pt_regs(task)->user_regs,
+	       sizeof(page->regs));
+	memcpy(&page->fpsimd, &task->thread.uw.fpsimd_state,
+	       sizeof(page->fpsimd));
+	smp_wmb();
+	WRITE_ONCE(page->seq, page->seq + 1);
+}
+
+// Apply the registers userspace changed in the page, called by the thread
+// itself on continue
+static void bp_regs_apply(struct rwmem_bp_regs_page *page)
+{
+	struct pt_regs *regs = task_pt_regs(current);
+	uint32_t dirty = READ_ONCE(page->dirty);
+	uint64_t pstate = regs->pstate;
+
+	smp_rmb();
+	if (dirty & RWMEM_BP_REGS_DIRTY_GPR) {
+		memcpy(&regs->user_regs, &page->regs, sizeof(page->regs));
+		// never let userspace pick an exception level
+		if (!valid_user_regs(&regs->user_regs, current)) {
+			regs->pstate = pstate;
+		}
+	}
+	if (dirty & RWMEM_BP_REGS_DIRTY_SIMD) {
+		fpsimd_preserve_current_state();
+		memcpy(&current->thread.uw.fpsimd_state, &page->fpsimd,
+		       sizeof(page->fpsimd));
+		fpsimd_flush_task_state(current);
+	}
+}
+
+// Report an event to the queue the bp is attached to, if it wants that type
+static void bp_queue_event(struct rwmem_bp_private_data *data, uint32_t type,
+			   struct pt_regs *regs, unsigned long addr)
+{
+	struct rwmem_bp_queue_link *link;
+
+	rcu_read_lock();
+	link = rcu_dereference(data->queue);
+	if (link && (link->flags & (1U << type))) {
+		rwmem_bp_queue_push(link, type, regs, addr);
+	}
+	rcu_read_unlock();
+}
 
 static void bp_callback_after(struct callback_head *twork)
 {
 	struct hit_bp_cb *twcb = container_of(twork, struct hit_bp_cb, twork);
-	struct rwmem_bp_private_data *priv_data = twcb->file->private_data;
+	struct rwmem_bp_private_data *priv_data = twcb->data;
+	struct rwmem_bp_regs_page *regs_page;
+
+	hit_cb_put(twcb);
 
-	// mark stopped
+	// only one thread is stopped at a time, the others queue up here
 	spin_lock(&priv_data->flag_lock);
+	while (priv_data->stopped_flag && !priv_data->released) {
+		spin_unlock(&priv_data->flag_lock);
+		wait_event(priv_data->wq, !priv_data->stopped_flag ||
+						  priv_data->released);
+		spin_lock(&priv_data->flag_lock);
+	}
+	if (priv_data->released) {
+		spin_unlock(&priv_data->flag_lock);
+		rwmem_bp_put(priv_data);
+		return;
+	}
+
+	// mark stopped, the register page is filled first so it is valid as
+	// soon as the stop can be seen
+	regs_page = smp_load_acquire(&priv_data->regs_page);
+	if (regs_page) {
+		fpsimd_preserve_current_state();
+		bp_regs_fill(regs_page, current);
+	}
 	priv_data->stopped_flag = true;
+	priv_data->stopped_task = current;
 	spin_unlock(&priv_data->flag_lock);
+	trace_rwmem_bp_stop(current->pid, task_pt_regs(current)->pc);
+	bp_queue_event(priv_data, RWMEM_BP_EVENT_STOP, task_pt_regs(current),
+		       0);
 
 	// wake up the fasync
 	kill_fasync(&priv_data->fasync, SIGIO, POLL_IN);
@@ -49,82 +268,431 @@ static void bp_callback_after(struct callback_head *twork)
 
 	// wait for continue
 	wait_event(priv_data->wq, priv_data->continue_flag);
+	regs_page = smp_load_acquire(&priv_data->regs_page);
+	if (regs_page && !READ_ONCE(priv_data->released)) {
+		bp_regs_apply(regs_page);
+	}
 
 	// we can continue here, unset flags
 	atomic_set(&priv_data->poll, 0);
 	spin_lock(&priv_data->flag_lock);
 	priv_data->continue_flag = false;
 	priv_data->stopped_flag = false;
+	priv_data->stopped_task = NULL;
 	spin_unlock(&priv_data->flag_lock);
 
-	// clean up
-	kfree(twcb);
+	// let the next queued thread stop
+	wake_up_all(&priv_data->wq);
+	rwmem_bp_put(priv_data);
+}
+
+static void hit_cb_queue(struct hit_bp_cb *twcb)
+{
+	init_task_work(&twcb->twork, bp_callback_after);
+	// the thread is exiting
+	if (task_work_add(current, &twcb->twork, TWA_RESUME)) {
+		hit_cb_put(twcb);
+		rwmem_bp_put(twcb->data);
+	}
+}
+
+static void bp_log_hit(struct rwmem_bp_private_data *data,
+		       struct pt_regs *regs, unsigned long addr)
+{
+	struct rwmem_ring *ring = smp_load_acquire(&data->ring);
+	struct rwmem_bp_record rec;
+	unsigned long flags;
+	uint64_t pos, start, mask;
+
+	if (!ring || !rwmem_ring_begin(ring, &pos, &flags)) {
+		return;
+	}
+	start = pos;
+	rec.time = ktime_get_ns();
+	rec.tid = current->pid;
+	rec.mem_valid = 0;
+	rec.pc = regs->pc;
+	rec.addr = addr;
+	rwmem_ring_put(ring, &pos, &rec, sizeof(rec));
+	for (mask = data->log.reg_mask; mask; mask &= mask - 1) {
+		uint64_t value = bp_reg_value(regs, __ffs64(mask), addr);
+		rwmem_ring_put(ring, &pos, &value, sizeof(value));
+	}
+	if (data->log.mem_len) {
+		unsigned long base = bp_reg_value(regs, data->log.mem_reg, addr) +
+				     data->log.mem_offset;
+		rec.mem_valid = rwmem_ring_put_user(ring, &pos,
+						    (const void __user *)base,
+						    data->log.mem_len);
+		pos = start + offsetof(struct rwmem_bp_record, mem_valid);
+		rwmem_ring_put(ring, &pos, &rec.mem_valid,
+			       sizeof(rec.mem_valid));
+	}
+	rwmem_ring_end(ring, flags);
+}
+
+// A hit of a logpoint with RWMEM_BP_LOG_NEW_VALUE, waiting for its thread to
+// step over the instruction. The step hook writes the whole record then.
+struct value_entry {
+	pid_t pid;
+	bool was_stepping; // the thread was single stepping already
+	struct rwmem_bp_private_data *data; // holds a reference
+	unsigned long base; // the recorded memory
+	struct rwmem_bp_record rec;
+	uint64_t regs[RWMEM_BP_NUM_REGS];
+	uint8_t old[RWMEM_BP_LOG_VALUE_MAX];
+};
+
+// one thread has at most one pending hit, a pool this size is plenty
+#define RWMEM_BP_VALUE_POOL_SIZE 128
+
+static struct value_entry value_pool[RWMEM_BP_VALUE_POOL_SIZE];
+static DECLARE_BITMAP(value_pool_used, RWMEM_BP_VALUE_POOL_SIZE);
+static DEFINE_RAW_SPINLOCK(value_lock);
+
+// Snapshot the hit and the old value, and step the thread over the
+// instruction. Called from exception context.
+static void bp_value_begin(struct rwmem_bp_private_data *data,
+			   struct pt_regs *regs, unsigned long addr)
+{
+	struct rwmem_bp_private_data *stale = NULL;
+	struct value_entry *entry = NULL;
+	unsigned long flags;
+	unsigned int i, n = 0;
+	uint64_t mask;
+
+	raw_spin_lock_irqsave(&value_lock, flags);
+	// a thread which never finished its step, e.g. the instruction
+	// faulted, gives its entry to the new hit
+	for_each_set_bit (i, value_pool_used, RWMEM_BP_VALUE_POOL_SIZE) {
+		if (value_pool[i].pid == current->pid) {
+			entry = &value_pool[i];
+			stale = entry->data;
+			break;
+		}
+	}
+	if (!entry) {
+		i = find_first_zero_bit(value_pool_used,
+					RWMEM_BP_VALUE_POOL_SIZE);
+		if (i < RWMEM_BP_VALUE_POOL_SIZE) {
+			entry = &value_pool[i];
+			__set_bit(i, value_pool_used);
+			entry->was_stepping = test_thread_flag(TIF_SINGLESTEP);
+		}
+	}
+	if (!entry) {
+		// the hit is lost like a hit on a full ring
+		raw_spin_unlock_irqrestore(&value_lock, flags);
+		return;
+	}
+	refcount_inc(&data->ref);
+	entry->pid = current->pid;
+	entry->data = data;
+	entry->base = bp_reg_value(regs, data->log.mem_reg, addr) +
+		      data->log.mem_offset;
+	entry->rec.time = ktime_get_ns();
+	entry->rec.tid = current->pid;
+	entry->rec.pc = regs->pc;
+	entry->rec.addr = addr;
+	for (mask = data->log.reg_mask; mask; mask &= mask - 1) {
+		entry->regs[n++] = bp_reg_value(regs, __ffs64(mask), addr);
+	}
+	entry->rec.mem_valid =
+		copy_from_user_nofault(entry->old,
+				       (const void __user *)entry->base,
+				       data->log.mem_len) ?
+			0 :
+			data->log.mem_len;
+	raw_spin_unlock_irqrestore(&value_lock, flags);
+
+	// the hardware bp is suspended for the step and reinstalled before
+	// the step hook runs
+	if (!test_thread_flag(TIF_SINGLESTEP)) {
+		user_enable_single_step(current);
+	}
+	if (stale) {
+		rwmem_bp_put(stale);
+	}
+}
+
+// Called from the single step hook. Returns true if the current thread
+// stepped for a pending logpoint hit.
+static bool bp_value_step(void)
+{
+	struct rwmem_bp_private_data *data;
+	struct value_entry entry;
+	struct rwmem_ring *ring;
+	unsigned long flags;
+	uint64_t pos, start;
+	uint32_t new_valid;
+	unsigned int i;
+	bool found = false;
+
+	if (bitmap_empty(value_pool_used, RWMEM_BP_VALUE_POOL_SIZE)) {
+		return false;
+	}
+	raw_spin_lock_irqsave(&value_lock, flags);
+	for_each_set_bit (i, value_pool_used, RWMEM_BP_VALUE_POOL_SIZE) {
+		if (value_pool[i].pid == current->pid) {
+			entry = value_pool[i];
+			__clear_bit(i, value_pool_used);
+			found = true;
+			break;
+		}
+	}
+	raw_spin_unlock_irqrestore(&value_lock, flags);
+	if (!found) {
+		return false;
+	}
+	if (!entry.was_stepping) {
+		user_disable_single_step(current);
+	}
+
+	data = entry.data;
+	ring = smp_load_acquire(&data->ring);
+	if (!READ_ONCE(data->released) && ring &&
+	    rwmem_ring_begin(ring, &pos, &flags)) {
+		start = pos;
+		rwmem_ring_put(ring, &pos, &entry.rec, sizeof(entry.rec));
+		rwmem_ring_put(ring, &pos, entry.regs,
+			       hweight64(data->log.reg_mask) *
+				       sizeof(uint64_t));
+		rwmem_ring_put(ring, &pos, entry.old, data->log.mem_len);
+		new_valid = rwmem_ring_put_user(
+			ring, &pos, (const void __user *)entry.base,
+			data->log.mem_len);
+		if (new_valid < entry.rec.mem_valid) {
+			pos = start + offsetof(struct rwmem_bp_record,
+					       mem_valid);
+			rwmem_ring_put(ring, &pos, &new_valid,
+				       sizeof(new_valid));
+		}
+		rwmem_ring_end(ring, flags);
+	}
+	rwmem_bp_put(data);
+	return true;
+}
+
+// Drop the pending hits of a closed bp, their threads may never step
+static void bp_value_drop(struct rwmem_bp_private_data *data)
+{
+	unsigned long flags;
+	unsigned int i, dropped = 0;
+
+	raw_spin_lock_irqsave(&value_lock, flags);
+	for_each_set_bit (i, value_pool_used, RWMEM_BP_VALUE_POOL_SIZE) {
+		if (value_pool[i].data == data) {
+			__clear_bit(i, value_pool_used);
+			dropped++;
+		}
+	}
+	raw_spin_unlock_irqrestore(&value_lock, flags);
+	while (dropped--) {
+		rwmem_bp_put(data);
+	}
+}
+
+// Whether the thread stops after the instruction it just stepped
+static bool bp_step_done(struct step_entry *entry, struct pt_regs *regs)
+{
+	if (--entry->remaining == 0) {
+		return true;
+	}
+	switch (entry->mode) {
+	case RWMEM_BP_STEP_UNTIL:
+		return regs->pc >= entry->start && regs->pc < entry->end;
+	case RWMEM_BP_STEP_OUT:
+		// a recursive call returns to the same address on a deeper stack
+		return regs->pc == entry->ret_addr && regs->sp >= entry->ret_sp;
+	case RWMEM_BP_STEP_WHILE:
+		return regs->pc < entry->start || regs->pc >= entry->end;
+	default:
+		return false;
+	}
 }
 
 int rwmem_bp_step_handler(struct pt_regs *regs, unsigned long esr)
 {
 	pid_t pid = current->pid;
 	struct hit_bp_cb *twcb;
-	struct list_head *pos;
-	struct step_list_entry *entry;
-	struct file *file = NULL;
-	bool removed;
-
-	// Find the file associated with the pid
-	spin_lock(&step_list_lock);
-	list_for_each (pos, &step_list) {
-		entry = list_entry(pos, struct step_list_entry, list);
-		if (entry->pid == pid) {
-			file = entry->file;
-			removed = entry->removed;
-			list_del(pos);
-			kfree(entry);
-			// if the file is closed, just ignore it
-			if (removed) {
-				printk(KERN_INFO
-				       "step_callback find a removed step\n");
-				spin_unlock(&step_list_lock);
-				return DBG_HOOK_HANDLED;
-			}
-			break;
-		}
+	struct step_entry *found;
+	struct rwmem_bp_private_data *data = NULL;
+	bool stepped;
+	u64 start = rwmem_stat_begin();
+
+	// a step of the instruction in the slot of a software breakpoint is a
+	// step of the original, the thread continues behind the breakpoint
+	rwmem_swbp_step(regs);
+	// a software watchpoint re-arms its page after the access and a
+	// logpoint records the new value
+	stepped = rwmem_swwp_step();
+	stepped |= bp_value_step();
+
+	// Find the bp associated with the pid. Only this thread removes its
+	// entry once it is stepping, so it stays valid after the lookup.
+	rcu_read_lock();
+	found = step_entry_find(pid);
+	rcu_read_unlock();
+
+	// the trace records the state after every stepped instruction
+	if (found && !READ_ONCE(found->data->released) &&
+	    found->flags & RWMEM_BP_STEP_FLAG_TRACE) {
+		bp_log_hit(found->data, regs, regs->pc);
+	}
+	if (found && !READ_ONCE(found->data->released) &&
+	    !bp_step_done(found, regs)) {
+		// step the next instruction without waking up userspace
+		user_rewind_single_step(current);
+		rwmem_stat_end(RWMEM_STAT_BP_STEP, start, 0, 0);
+		return DBG_HOOK_HANDLED;
+	}
+	if (found) {
+		data = found->data;
+		spin_lock(step_bucket_lock(pid));
+		hash_del_rcu(&found->node);
+		spin_unlock(step_bucket_lock(pid));
+		step_entry_free(found);
 	}
-	spin_unlock(&step_list_lock);
 
-	// If no file is found, we cannot continue
-	if (!file) {
+	// If no bp is found, we cannot continue
+	if (!data) {
+		if (stepped) {
+			rwmem_stat_end(RWMEM_STAT_BP_STEP, start, 0, 0);
+			return DBG_HOOK_HANDLED;
+		}
+		rwmem_stat_end(RWMEM_STAT_BP_STEP, start, -ENOENT, 0);
 		return DBG_HOOK_ERROR;
 	}
+	// if the file is closed, just ignore it
+	if (READ_ONCE(data->released)) {
+		printk_debug(KERN_INFO "step_callback find a removed step\n");
+		user_disable_single_step(current);
+		rwmem_bp_put(data);
+		rwmem_stat_end(RWMEM_STAT_BP_STEP, start, 0, 0);
+		return DBG_HOOK_HANDLED;
+	}
 
-	// create a resume task
-	printk(KERN_INFO "step_callback %lx\n", regs->pc);
-	twcb = kzalloc(sizeof(*twcb), GFP_KERNEL);
-	twcb->file = file;
-	init_task_work(&twcb->twork, bp_callback_after);
-	task_work_add(current, &twcb->twork, TWA_RESUME);
+	// create a resume task, it replaces the reference of the entry
+	trace_rwmem_bp_step(pid, regs->pc);
+	twcb = hit_cb_get(data);
+	rwmem_bp_put(data);
+	if (!twcb) {
+		user_disable_single_step(current);
+		rwmem_stat_end(RWMEM_STAT_BP_STEP, start, -EBUSY, 0);
+		return DBG_HOOK_HANDLED;
+	}
+	hit_cb_queue(twcb);
 
 	// remove the single step flag
 	user_disable_single_step(current);
+	rwmem_stat_end(RWMEM_STAT_BP_STEP, start, 0, 0);
 	return DBG_HOOK_HANDLED;
 }
 
+// Count the hit and decide whether the hit policy wants it handled
+static bool bp_hit_counted(struct rwmem_bp_private_data *data)
+{
+	uint64_t n = atomic64_inc_return(&data->hits);
+	uint64_t ignore_count = READ_ONCE(data->ignore_count);
+	uint64_t every_n = READ_ONCE(data->every_n);
+
+	if (n <= ignore_count) {
+		return false;
+	}
+	return every_n <= 1 || (n - ignore_count) % every_n == 0;
+}
+
+// Handle a hit of the current thread, from a hardware bp or a software
+// watchpoint
+void rwmem_bp_hit(struct rwmem_bp_private_data *data, struct pt_regs *regs,
+		  unsigned long addr)
+{
+	struct hit_bp_cb *twcb;
+	struct rwmem_bp_actions *actions;
+	struct rwmem_bp_cond *cond;
+	struct rwmem_bp_aggr *aggr;
+	struct rwmem_bp_stacks *stacks;
+	u64 start = rwmem_stat_begin();
+	int ret = 0;
+
+	// a false condition lets the thread run on without any trace of the hit
+	rcu_read_lock();
+	cond = rcu_dereference(data->cond);
+	if (cond && !rwmem_bp_cond_eval(cond, regs, addr)) {
+		rcu_read_unlock();
+		rwmem_stat_end(RWMEM_STAT_BP_HIT, start, 0, 0);
+		return;
+	}
+	rcu_read_unlock();
+
+	if (!bp_hit_counted(data)) {
+		rwmem_stat_end(RWMEM_STAT_BP_HIT, start, 0, 0);
+		return;
+	}
+
+	trace_rwmem_bp_hit(current->pid, regs->pc, addr);
+	bp_queue_event(data, RWMEM_BP_EVENT_HIT, regs, addr);
+
+	switch (READ_ONCE(data->mode)) {
+	case RWMEM_BP_MODE_LOG:
+		if (data->log.flags & RWMEM_BP_LOG_NEW_VALUE) {
+			bp_value_begin(data, regs, addr);
+		} else {
+			bp_log_hit(data, regs, addr);
+		}
+		rwmem_stat_end(RWMEM_STAT_BP_HIT, start, 0, 0);
+		return;
+	case RWMEM_BP_MODE_AGGR:
+		aggr = smp_load_acquire(&data->aggr);
+		if (aggr) {
+			rwmem_bp_aggr_add(aggr, regs, addr);
+		}
+		rwmem_stat_end(RWMEM_STAT_BP_HIT, start, 0, 0);
+		return;
+	case RWMEM_BP_MODE_STACK:
+		stacks = smp_load_acquire(&data->stacks);
+		if (stacks) {
+			rwmem_bp_stacks_add(stacks, regs, addr);
+		}
+		rwmem_stat_end(RWMEM_STAT_BP_HIT, start, 0, 0);
+		return;
+	case RWMEM_BP_MODE_ACTION:
+		rcu_read_lock();
+		actions = rcu_dereference(data->actions);
+		if (actions) {
+			ret = rwmem_bp_actions_run(actions, regs, addr);
+		}
+		rcu_read_unlock();
+		rwmem_stat_end(RWMEM_STAT_BP_HIT, start, ret, 0);
+		return;
+	}
+
+	// create a resume task, it holds a reference until the thread resumes
+	twcb = hit_cb_get(data);
+	if (!twcb) {
+		rwmem_stat_end(RWMEM_STAT_BP_HIT, start, -EBUSY, 0);
+		return;
+	}
+	hit_cb_queue(twcb);
+	rwmem_stat_end(RWMEM_STAT_BP_HIT, start, 0, 0);
+}
+
 void bp_callback(struct perf_event *perf, struct perf_sample_data *sample_data,
 		 struct pt_regs *regs)
 {
-	struct hit_bp_cb *twcb;
 	struct file *file =
 		(void *)((uint64_t)(perf->overflow_handler_context) |
 			 ((uint64_t)0xff << 56));
-	struct debug_info *debug_info;
-	debug_info = &current->thread.debug;
-
-	printk(KERN_INFO "bp_callback %lx\n", regs->pc);
+	struct rwmem_bp_private_data *data = file->private_data;
+	unsigned long addr = bp_access_addr(perf, regs);
+	unsigned long range_end = READ_ONCE(data->range_end);
 
-	// create a resume task
-	twcb = kzalloc(sizeof(*twcb), GFP_KERNEL);
-	twcb->file = file;
-	init_task_work(&twcb->twork, bp_callback_after);
-	task_work_add(current, &twcb->twork, TWA_RESUME);
+	// a masked watchpoint covers the whole aligned block around the range
+	if (range_end &&
+	    (addr < READ_ONCE(data->range_start) || addr >= range_end)) {
+		return;
+	}
+	rwmem_bp_hit(data, regs, addr);
 }
 
 static int rwmem_bp_fasync(int fd, struct file *filp, int on)
@@ -154,34 +722,30 @@ static __poll_t rwmem_bp_poll(struct file *file, poll_table *wait)
 
 int rwmem_bp_release(struct inode *inode, struct file *filp)
 {
-	struct step_list_entry *entry;
 	struct rwmem_bp_private_data *data = filp->private_data;
-	// wake up target task
+	unsigned int i;
+
+	// wake up the stopped thread and drop the queued ones, a pending step
+	// sees the flag too
 	spin_lock(&data->flag_lock);
+	data->released = true;
 	data->continue_flag = true;
 	spin_unlock(&data->flag_lock);
 	wake_up_all(&data->wq);
 
-	// mark the file as removed
-	spin_lock(&step_list_lock);
-	list_for_each_entry (entry, &step_list, list) {
-		if (entry->file == filp) {
-			entry->removed = true;
-			break;
-		}
+	// clean up, this also removes the events inherited by new threads
+	if (data->swwp) {
+		rwmem_swwp_remove(data->swwp);
 	}
-	spin_unlock(&step_list_lock);
-
-	// clean up
-	if (data->event) {
-		unregister_hw_breakpoint(data->event);
+	if (data->swbp) {
+		rwmem_swbp_remove(data->swbp);
 	}
-	if (data->target_task) {
-		put_task_struct(data->target_task);
+	for (i = 0; i < data->nr_events; i++) {
+		unregister_hw_breakpoint(data->events[i]);
 	}
-
-	kfree(data);
+	bp_value_drop(data);
 	filp->private_data = NULL;
+	rwmem_bp_put(data);
 	return 0;
 }
 ssize_t rwmem_bp_read(struct file *filp, char __user *buf, size_t size,
@@ -190,59 +754,379 @@ ssize_t rwmem_bp_read(struct file *filp, char __user *buf, size_t size,
 	struct rwmem_bp_private_data *data = filp->private_data;
 	struct user_fpsimd_state *uregs;
 	struct pt_regs *pt_regs;
+	struct task_struct *task;
+	ssize_t ret;
 
-	// If the target task is not stopped, we cannot read the registers
-	if (!data->stopped_flag) {
+	// If no thread is stopped, we cannot read the registers
+	task = bp_get_stopped_task(data);
+	if (!task) {
 		return -EINVAL;
 	}
-	pt_regs = task_pt_regs(data->target_task);
+	pt_regs = task_pt_regs(task);
 
 	if (sizeof(pt_regs->user_regs) + sizeof(*uregs) <= size) {
 		// The buffer is large enough. Copy both pt_regs and uregs
-		uregs = &data->target_task->thread.uw.fpsimd_state;
+		uregs = &task->thread.uw.fpsimd_state;
 		if (x_copy_to_user(buf, &pt_regs->user_regs,
-				   sizeof(pt_regs->user_regs))) {
-			return -EFAULT;
-		}
-		if (x_copy_to_user(buf + sizeof(pt_regs->user_regs), uregs,
+				   sizeof(pt_regs->user_regs)) ||
+		    x_copy_to_user(buf + sizeof(pt_regs->user_regs), uregs,
 				   sizeof(*uregs))) {
-			return -EFAULT;
+			ret = -EFAULT;
+		} else {
+			ret = sizeof(*pt_regs) + sizeof(*uregs);
 		}
-		return sizeof(*pt_regs) + sizeof(*uregs);
 	} else if (sizeof(pt_regs->user_regs) <= size) {
 		// The buffer is large enough for pt_regs only
 		if (x_copy_to_user(buf, &pt_regs->user_regs,
 				   sizeof(pt_regs->user_regs))) {
-			return -EFAULT;
+			ret = -EFAULT;
+		} else {
+			ret = sizeof(*pt_regs);
 		}
-		return sizeof(*pt_regs);
 	} else {
 		// The buffer is too small
+		ret = -EINVAL;
+	}
+	put_task_struct(task);
+	return ret;
+}
+// The ring, the aggregation table and the stack table exclude each other,
+// checked with flag_lock held where the new one is published
+static bool bp_collector_busy(struct rwmem_bp_private_data *data)
+{
+	return data->ring || data->aggr || data->stacks;
+}
+
+// Allocate the ring buffer of a logpoint or of an instruction trace
+static long bp_set_ring(struct rwmem_bp_private_data *data, unsigned long arg,
+			bool log)
+{
+	struct bp_log_param param;
+	struct rwmem_ring *ring;
+	uint32_t record_size, mem_size;
+	if (x_copy_from_user((void *)&param, (void *)arg, sizeof(param))) {
+		return -EFAULT;
+	}
+	if (param.reg_mask >> RWMEM_BP_NUM_REGS ||
+	    param.mem_reg > RWMEM_BP_REG_ADDR || param.mem_len > PAGE_SIZE ||
+	    param.flags & ~RWMEM_BP_LOG_NEW_VALUE) {
+		return -EINVAL;
+	}
+	if (param.flags & RWMEM_BP_LOG_NEW_VALUE &&
+	    (!log || param.mem_len > RWMEM_BP_LOG_VALUE_MAX)) {
 		return -EINVAL;
 	}
+	// the old and the new value of RWMEM_BP_LOG_NEW_VALUE
+	mem_size = param.flags & RWMEM_BP_LOG_NEW_VALUE ? param.mem_len * 2 :
+							  param.mem_len;
+	record_size = round_up(sizeof(struct rwmem_bp_record) +
+				       hweight64(param.reg_mask) *
+					       sizeof(uint64_t) +
+				       mem_size,
+			       8);
+	ring = rwmem_ring_alloc(param.ring_pages, record_size);
+	if (IS_ERR(ring)) {
+		return PTR_ERR(ring);
+	}
+	// the ring is mapped by userspace, it can not be replaced
+	spin_lock(&data->flag_lock);
+	if (bp_collector_busy(data)) {
+		spin_unlock(&data->flag_lock);
+		rwmem_ring_free(ring);
+		return -EBUSY;
+	}
+	data->log = param;
+	smp_store_release(&data->ring, ring);
+	if (log) {
+		WRITE_ONCE(data->mode, RWMEM_BP_MODE_LOG);
+	}
+	spin_unlock(&data->flag_lock);
+	return 0;
 }
-long rwmem_bp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+
+// Let the stopped thread single step until the condition of param is met
+static bool bp_step_valid(struct rwmem_bp_private_data *data,
+			  const struct bp_step_param *param)
 {
-	switch (cmd) {
-	case IOCTL_BP_CONTINUE: {
-		struct rwmem_bp_private_data *data = filp->private_data;
-		// If the target task is not stopped, we cannot continue
-		if (!data->stopped_flag) {
+	if (param->mode > RWMEM_BP_STEP_WHILE ||
+	    (param->mode == RWMEM_BP_STEP_N && !param->count) ||
+	    ((param->mode == RWMEM_BP_STEP_UNTIL ||
+	      param->mode == RWMEM_BP_STEP_WHILE) &&
+	     param->start >= param->end)) {
+		return false;
+	}
+	return !(param->flags & RWMEM_BP_STEP_FLAG_TRACE) ||
+	       smp_load_acquire(&data->ring);
+}
+
+// Wake up the stopped thread
+static void bp_wake(struct rwmem_bp_private_data *data)
+{
+	spin_lock(&data->flag_lock);
+	data->continue_flag = true;
+	spin_unlock(&data->flag_lock);
+	wake_up(&data->wq);
+}
+
+// Start stepping the stopped task with a reserved entry, this can not fail
+static void bp_step_start(struct rwmem_bp_private_data *data,
+			  struct task_struct *task, struct step_entry *entry,
+			  const struct bp_step_param *param)
+{
+	struct pt_regs *regs = task_pt_regs(task);
+	struct debug_info *debug_info;
+	struct step_entry *old;
+
+	refcount_inc(&data->ref);
+	entry->pid = task->pid;
+	entry->data = data;
+	entry->mode = param->mode;
+	entry->flags = param->flags;
+	entry->remaining = param->count ? param->count : U64_MAX;
+	entry->start = param->start;
+	entry->end = param->end;
+	entry->ret_addr = regs->regs[30];
+	entry->ret_sp = regs->sp;
+	// Add the pid to the step table, an entry left behind by a thread
+	// which exited while stepping may hold the same (reused) pid
+	spin_lock(step_bucket_lock(entry->pid));
+	old = step_entry_find(entry->pid);
+	if (old) {
+		hash_del_rcu(&old->node);
+	}
+	hash_add_rcu(step_table, &entry->node, entry->pid);
+	spin_unlock(step_bucket_lock(entry->pid));
+	if (old) {
+		rwmem_bp_put(old->data);
+		step_entry_free(old);
+	}
+
+	// Set the single step flag
+	debug_info = &task->thread.debug;
+	// FIXME: check whether the target task is already in single step mode (for example ptrace)
+	// Currently, we just consider whether it is in step mode by hw_breakpoint.
+	if (test_ti_thread_flag(&task->thread_info, TIF_SINGLESTEP))
+		debug_info->suspended_step = 1;
+	else
+		user_enable_single_step(task);
+	bp_wake(data);
+}
+
+static long bp_step(struct rwmem_bp_private_data *data,
+		    const struct bp_step_param *param)
+{
+	struct step_entry *entry;
+	struct task_struct *task;
+
+	if (!bp_step_valid(data, param)) {
+		return -EINVAL;
+	}
+	// If no thread is stopped, we cannot continue
+	task = bp_get_stopped_task(data);
+	if (!task) {
+		return -EINVAL;
+	}
+	entry = step_entry_alloc();
+	if (!entry) {
+		put_task_struct(task);
+		return -EBUSY;
+	}
+	bp_step_start(data, task, entry, param);
+	put_task_struct(task);
+	return 0;
+}
+
+static long bp_continue(struct rwmem_bp_private_data *data)
+{
+	struct task_struct *task = bp_get_stopped_task(data);
+	// If no thread is stopped, we cannot continue
+	if (!task) {
+		return -EINVAL;
+	}
+	trace_rwmem_bp_continue(task->pid, task_pt_regs(task)->pc);
+	put_task_struct(task);
+	bp_wake(data);
+	return 0;
+}
+
+// Apply all register writes to the stopped thread, then continue or step it
+static long bp_resume(struct rwmem_bp_private_data *data, unsigned long arg)
+{
+	struct user_fpsimd_state *uregs;
+	struct step_entry *entry = NULL;
+	struct bp_resume_param param;
+	struct bp_reg_write *writes;
+	struct user_pt_regs gprs;
+	struct task_struct *task;
+	bool simd = false;
+	uint32_t i;
+	long ret = 0;
+
+	if (x_copy_from_user((void *)&param, (void *)arg, sizeof(param))) {
+		return -EFAULT;
+	}
+	if (param.count > RWMEM_BP_MAX_REG_WRITES ||
+	    param.action > RWMEM_BP_RESUME_STEP ||
+	    (param.action == RWMEM_BP_RESUME_STEP &&
+	     !bp_step_valid(data, &param.step))) {
+		return -EINVAL;
+	}
+	writes = kmalloc_array(param.count, sizeof(*writes), GFP_KERNEL);
+	if (!writes && param.count) {
+		return -ENOMEM;
+	}
+	if (x_copy_from_user(writes, (void *)param.writes,
+			     sizeof(*writes) * param.count)) {
+		kfree(writes);
+		return -EFAULT;
+	}
+	for (i = 0; i < param.count; i++) {
+		if (writes[i].kind > RWMEM_BP_REG_SIMD || writes[i].id >= 34) {
+			kfree(writes);
 			return -EINVAL;
 		}
-		spin_lock(&data->flag_lock);
-		data->continue_flag = true;
-		spin_unlock(&data->flag_lock);
-		wake_up(&data->wq);
-		return 0;
+	}
+
+	task = bp_get_stopped_task(data);
+	if (!task) {
+		kfree(writes);
+		return -EINVAL;
+	}
+	// build the new GPRs aside, so a bad pstate rejects the whole batch
+	gprs = task_pt_regs(task)->user_regs;
+	for (i = 0; i < param.count; i++) {
+		if (writes[i].kind == RWMEM_BP_REG_GPR) {
+			gprs.regs[writes[i].id] = (uint64_t)writes[i].value;
+		} else {
+			simd = true;
+		}
+	}
+	if (!valid_user_regs(&gprs, task)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	// reserve the step before anything is written, nothing fails after it
+	if (param.action == RWMEM_BP_RESUME_STEP) {
+		entry = step_entry_alloc();
+		if (!entry) {
+			ret = -EBUSY;
+			goto out;
+		}
+	}
+	task_pt_regs(task)->user_regs = gprs;
+	if (simd) {
+		uregs = &task->thread.uw.fpsimd_state;
+		for (i = 0; i < param.count; i++) {
+			if (writes[i].kind != RWMEM_BP_REG_SIMD) {
+				continue;
+			}
+			if (writes[i].id < 32) {
+				uregs->vregs[writes[i].id] = writes[i].value;
+			} else if (writes[i].id == 32) {
+				uregs->fpsr = writes[i].value;
+			} else {
+				uregs->fpcr = writes[i].value;
+			}
+		}
+		// the thread is asleep, reload its state from memory
+		fpsimd_flush_task_state(task);
+	}
+
+	if (entry) {
+		bp_step_start(data, task, entry, &param.step);
+	} else {
+		trace_rwmem_bp_continue(task->pid, task_pt_regs(task)->pc);
+		bp_wake(data);
+	}
+out:
+	put_task_struct(task);
+	kfree(writes);
+	return ret;
+}
+
+// Change address, length and type of every event of a hardware bp. Either
+// all events are changed or none.
+static long bp_modify(struct rwmem_bp_private_data *data, unsigned long arg)
+{
+	struct perf_event_attr attr, old_attr;
+	unsigned long old_start, old_end;
+	struct bp_modify_param param;
+	uint64_t bp_addr, bp_len;
+	unsigned int i;
+	long ret = 0;
+
+	if (x_copy_from_user((void *)&param, (void *)arg, sizeof(param))) {
+		return -EFAULT;
+	}
+	if (!param.type || param.type > HW_BREAKPOINT_X) {
+		return -EINVAL;
+	}
+	if (param.flags & RWMEM_BP_FLAG_RANGE) {
+		if (param.type == HW_BREAKPOINT_X ||
+		    rwmem_bp_range(param.virt_addr, param.range_len, &bp_addr,
+				   &bp_len)) {
+			return -EINVAL;
+		}
+	} else {
+		if (param.len != 1 && param.len != 2 && param.len != 4 &&
+		    param.len != 8) {
+			return -EINVAL;
+		}
+		bp_addr = param.virt_addr;
+		bp_len = param.len;
+	}
+	// software watchpoints have no perf events to move
+	if (!data->nr_events) {
+		return -EINVAL;
+	}
+	if (data->process) {
+		return -EOPNOTSUPP;
+	}
+
+	mutex_lock(&data->events_lock);
+	old_attr = data->events[0]->attr;
+	old_start = data->range_start;
+	old_end = data->range_end;
+	attr = old_attr;
+	attr.bp_addr = bp_addr;
+	attr.bp_len = bp_len;
+	attr.bp_type = param.type;
+	attr.disabled = !!(param.flags & RWMEM_BP_FLAG_DISABLED);
+	if (param.flags & RWMEM_BP_FLAG_RANGE) {
+		WRITE_ONCE(data->range_start, param.virt_addr);
+		WRITE_ONCE(data->range_end, param.virt_addr + param.range_len);
+	} else {
+		WRITE_ONCE(data->range_end, 0);
+	}
+	for (i = 0; i < data->nr_events; i++) {
+		ret = modify_user_hw_breakpoint(data->events[i], &attr);
+		if (ret) {
+			break;
+		}
+	}
+	if (ret) {
+		// put the events changed so far back where they were
+		while (i--) {
+			modify_user_hw_breakpoint(data->events[i], &old_attr);
+		}
+		WRITE_ONCE(data->range_start, old_start);
+		WRITE_ONCE(data->range_end, old_end);
+	}
+	mutex_unlock(&data->events_lock);
+	return ret;
+}
+
+static long do_rwmem_bp_ioctl(struct file *filp, unsigned int cmd,
+			      unsigned long arg)
+{
+	switch (cmd) {
+	case IOCTL_BP_CONTINUE: {
+		return bp_continue(filp->private_data);
 	}
 	case IOCTL_BP_SET_REG: {
 		struct set_reg_param param;
 		struct rwmem_bp_private_data *data = filp->private_data;
-		struct pt_regs *pt_regs;
-		if (!data->stopped_flag) {
-			return -EINVAL;
-		}
+		struct task_struct *task;
 		if (x_copy_from_user((void *)&param, (void *)arg,
 				     sizeof(param))) {
 			return -EFAULT;
@@ -250,86 +1134,398 @@ long rwmem_bp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		if (param.id >= 34) {
 			return -EINVAL;
 		}
-		pt_regs = task_pt_regs(data->target_task);
-		pt_regs->user_regs.regs[param.id] = param.value;
+		task = bp_get_stopped_task(data);
+		if (!task) {
+			return -EINVAL;
+		}
+		task_pt_regs(task)->user_regs.regs[param.id] = param.value;
+		put_task_struct(task);
 		return 0;
 	}
 	case IOCTL_BP_SET_SIMD_REG: {
 		struct rwmem_bp_private_data *data = filp->private_data;
-		struct user_fpsimd_state *uregs =
-			&data->target_task->thread.uw.fpsimd_state;
+		struct user_fpsimd_state *uregs;
 		struct set_simd_reg_param param;
-		if (!data->stopped_flag) {
-			return -EINVAL;
-		}
+		struct task_struct *task;
+		long ret = 0;
 		if (x_copy_from_user((void *)&param, (void *)arg,
 				     sizeof(param))) {
 			return -EFAULT;
 		}
+		task = bp_get_stopped_task(data);
+		if (!task) {
+			return -EINVAL;
+		}
+		uregs = &task->thread.uw.fpsimd_state;
 		if (param.id < 32) {
 			uregs->vregs[param.id] = param.value;
-			return 0;
 		} else if (param.id == 32) {
 			uregs->fpsr = param.value;
-			return 0;
 		} else if (param.id == 33) {
 			uregs->fpcr = param.value;
-			return 0;
 		} else {
-			return -EINVAL;
+			ret = -EINVAL;
 		}
+		put_task_struct(task);
+		return ret;
+	}
+	case IOCTL_BP_RESUME: {
+		return bp_resume(filp->private_data, arg);
 	}
 	case IOCTL_BP_STEP: {
-		struct debug_info *debug_info;
-		struct step_list_entry *entry;
+		struct bp_step_param param = {
+			.mode = RWMEM_BP_STEP_N,
+			.count = 1,
+		};
+		return bp_step(filp->private_data, &param);
+	}
+	case IOCTL_BP_STEP_EX: {
+		struct bp_step_param param;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		return bp_step(filp->private_data, &param);
+	}
+	case IOCTL_BP_IS_STOPPED: {
 		struct rwmem_bp_private_data *data = filp->private_data;
-
-		// If the target task is not stopped, we cannot continue
-		if (!data->stopped_flag) {
+		struct task_struct *task = bp_get_stopped_task(data);
+		pid_t tid;
+		if (!task) {
+			return 0;
+		}
+		tid = task->pid;
+		put_task_struct(task);
+		return tid;
+	}
+	case IOCTL_BP_ENABLE: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		unsigned int i;
+		if (data->process) {
+			return -EOPNOTSUPP;
+		}
+		if (data->swwp) {
+			rwmem_swwp_enable(data->swwp);
+		}
+		if (data->swbp) {
+			rwmem_swbp_enable(data->swbp);
+		}
+		for (i = 0; i < data->nr_events; i++) {
+			perf_event_enable(data->events[i]);
+		}
+		return 0;
+	}
+	case IOCTL_BP_DISABLE: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		unsigned int i;
+		// the events inherited by threads created later would stay armed
+		if (data->process) {
+			return -EOPNOTSUPP;
+		}
+		if (data->swwp) {
+			rwmem_swwp_disable(data->swwp);
+		}
+		if (data->swbp) {
+			rwmem_swbp_disable(data->swbp);
+		}
+		for (i = 0; i < data->nr_events; i++) {
+			perf_event_disable(data->events[i]);
+		}
+		return 0;
+	}
+	case IOCTL_BP_MODIFY: {
+		return bp_modify(filp->private_data, arg);
+	}
+	case IOCTL_BP_SET_LOG: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		return bp_set_ring(data, arg, true);
+	}
+	case IOCTL_BP_SET_TRACE: {
+		return bp_set_ring(filp->private_data, arg, false);
+	}
+	case IOCTL_BP_GET_POOL_STATS: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		struct bp_pool_stats stats = {
+			.size = RWMEM_BP_HIT_POOL_SIZE,
+			.in_use = bitmap_weight(data->hit_pool_used,
+						RWMEM_BP_HIT_POOL_SIZE),
+			.exhausted = atomic64_read(&data->hit_pool_exhausted),
+		};
+		if (x_copy_to_user((void *)arg, &stats, sizeof(stats))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+	case IOCTL_BP_SET_COND: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		struct rwmem_bp_cond *cond = NULL, *old;
+		struct bp_cond_param param;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		if (param.count) {
+			cond = rwmem_bp_cond_create(&param);
+			if (IS_ERR(cond)) {
+				return PTR_ERR(cond);
+			}
+		}
+		spin_lock(&data->flag_lock);
+		old = rcu_replace_pointer(data->cond, cond,
+					  lockdep_is_held(&data->flag_lock));
+		spin_unlock(&data->flag_lock);
+		if (old) {
+			kfree_rcu(old, rcu);
+		}
+		return 0;
+	}
+	case IOCTL_BP_SET_QUEUE: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		struct rwmem_bp_queue_link *link = NULL, *old;
+		struct rwmem_bp_queue *queue;
+		struct bp_queue_param param;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		if (param.fd >= 0) {
+			if (!param.flags ||
+			    (param.flags & ~RWMEM_BP_QUEUE_ALL)) {
+				return -EINVAL;
+			}
+			queue = rwmem_bp_queue_get(param.fd);
+			if (IS_ERR(queue)) {
+				return PTR_ERR(queue);
+			}
+			link = kzalloc(sizeof(*link), GFP_KERNEL);
+			if (!link) {
+				rwmem_bp_queue_put(queue);
+				return -ENOMEM;
+			}
+			link->queue = queue;
+			link->id = param.id;
+			link->flags = param.flags;
+		}
+		spin_lock(&data->flag_lock);
+		old = rcu_replace_pointer(data->queue, link,
+					  lockdep_is_held(&data->flag_lock));
+		spin_unlock(&data->flag_lock);
+		rwmem_bp_queue_link_free(old);
+		return 0;
+	}
+	case IOCTL_BP_SET_ACTIONS: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		struct rwmem_bp_actions *actions = NULL, *old;
+		struct bp_action_param param;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		if (param.count) {
+			actions = rwmem_bp_actions_create(&param);
+			if (IS_ERR(actions)) {
+				return PTR_ERR(actions);
+			}
+		}
+		spin_lock(&data->flag_lock);
+		// logpoints and aggregation keep their mode
+		if (data->mode != RWMEM_BP_MODE_STOP &&
+		    data->mode != RWMEM_BP_MODE_ACTION) {
+			spin_unlock(&data->flag_lock);
+			kfree(actions);
+			return -EBUSY;
+		}
+		old = rcu_replace_pointer(data->actions, actions,
+					  lockdep_is_held(&data->flag_lock));
+		WRITE_ONCE(data->mode, actions ? RWMEM_BP_MODE_ACTION :
+						 RWMEM_BP_MODE_STOP);
+		spin_unlock(&data->flag_lock);
+		if (old) {
+			kfree_rcu(old, rcu);
+		}
+		return 0;
+	}
+	case IOCTL_BP_SET_HIT_POLICY: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		struct bp_hit_policy param;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		// the policy counts from the moment it is set
+		spin_lock(&data->flag_lock);
+		WRITE_ONCE(data->ignore_count, param.ignore_count);
+		WRITE_ONCE(data->every_n, param.every_n);
+		atomic64_set(&data->hits, 0);
+		spin_unlock(&data->flag_lock);
+		return 0;
+	}
+	case IOCTL_BP_GET_HIT_COUNT: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		uint64_t hits = atomic64_read(&data->hits);
+		if (x_copy_to_user((void *)arg, &hits, sizeof(hits))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+	case IOCTL_BP_SET_AGGR: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		struct rwmem_bp_aggr *aggr;
+		uint32_t capacity;
+		if (x_copy_from_user((void *)&capacity, (void *)arg,
+				     sizeof(capacity))) {
+			return -EFAULT;
+		}
+		aggr = rwmem_bp_aggr_alloc(capacity);
+		if (IS_ERR(aggr)) {
+			return PTR_ERR(aggr);
+		}
+		// hits may be adding to the table, it can not be replaced
+		spin_lock(&data->flag_lock);
+		if (bp_collector_busy(data)) {
+			spin_unlock(&data->flag_lock);
+			rwmem_bp_aggr_free(aggr);
+			return -EBUSY;
+		}
+		smp_store_release(&data->aggr, aggr);
+		WRITE_ONCE(data->mode, RWMEM_BP_MODE_AGGR);
+		spin_unlock(&data->flag_lock);
+		return 0;
+	}
+	case IOCTL_BP_READ_AGGR: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		struct rwmem_bp_aggr *aggr = smp_load_acquire(&data->aggr);
+		struct bp_aggr_read_param param;
+		long ret;
+		if (!aggr) {
 			return -EINVAL;
 		}
-		// Add the pid to the step list
-		spin_lock(&step_list_lock);
-		entry = (struct step_list_entry *)kmalloc(
-			sizeof(struct step_list_entry), GFP_KERNEL);
-		entry->pid = data->target_task->pid;
-		entry->file = filp;
-		entry->removed = false;
-		list_add(&entry->list, &step_list);
-		spin_unlock(&step_list_lock);
-
-		// Set the single step flag
-		debug_info = &data->target_task->thread.debug;
-		// FIXME: check whether the target task is already in single step mode (for example ptrace)
-		// Currently, we just consider whether it is in step mode by hw_breakpoint.
-		if (test_ti_thread_flag(&data->target_task->thread_info,
-					TIF_SINGLESTEP))
-			debug_info->suspended_step = 1;
-		else
-			user_enable_single_step(data->target_task);
-
-		// Wake up the target task
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		ret = rwmem_bp_aggr_read(aggr, &param);
+		if (ret >= 0 &&
+		    x_copy_to_user((void *)arg, &param, sizeof(param))) {
+			return -EFAULT;
+		}
+		return ret;
+	}
+	case IOCTL_BP_SET_STACKS: {
+		struct rwmem_bp_private_data *data = filp->private_data;
+		struct rwmem_bp_stacks *stacks;
+		struct bp_stack_param param;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		stacks = rwmem_bp_stacks_alloc(&param);
+		if (IS_ERR(stacks)) {
+			return PTR_ERR(stacks);
+		}
+		// hits may be adding to the table, it can not be replaced
 		spin_lock(&data->flag_lock);
-		data->continue_flag = true;
+		if (bp_collector_busy(data)) {
+			spin_unlock(&data->flag_lock);
+			rwmem_bp_stacks_free(stacks);
+			return -EBUSY;
+		}
+		smp_store_release(&data->stacks, stacks);
+		WRITE_ONCE(data->mode, RWMEM_BP_MODE_STACK);
 		spin_unlock(&data->flag_lock);
-		wake_up(&data->wq);
 		return 0;
 	}
-	case IOCTL_BP_IS_STOPPED: {
+	case IOCTL_BP_READ_STACKS: {
 		struct rwmem_bp_private_data *data = filp->private_data;
-		return !!data->stopped_flag;
+		struct rwmem_bp_stacks *stacks =
+			smp_load_acquire(&data->stacks);
+		struct bp_stack_read_param param;
+		long ret;
+		if (!stacks) {
+			return -EINVAL;
+		}
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		ret = rwmem_bp_stacks_read(stacks, &param);
+		if (ret >= 0 &&
+		    x_copy_to_user((void *)arg, &param, sizeof(param))) {
+			return -EFAULT;
+		}
+		return ret;
 	}
 	default:
 		return -EINVAL;
 	}
 }
 
+long rwmem_bp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	u64 start = rwmem_stat_begin();
+	long ret = do_rwmem_bp_ioctl(filp, cmd, arg);
+	rwmem_stat_end(rwmem_stat_ioctl_id(RWMEM_STAT_BP_IOCTL, cmd), start,
+		       ret, 0);
+	return ret;
+}
+
+// Map the register page, a thread which is stopped already is copied into
+// it when it is created
+static int bp_regs_mmap(struct rwmem_bp_private_data *data,
+			struct vm_area_struct *vma)
+{
+	struct rwmem_bp_regs_page *page = smp_load_acquire(&data->regs_page);
+
+	if (vma->vm_end - vma->vm_start != PAGE_SIZE) {
+		return -EINVAL;
+	}
+	// a private mapping would copy the page on a write and the stopped
+	// thread would never see the registers the user changed
+	if (!(vma->vm_flags & VM_SHARED)) {
+		return -EINVAL;
+	}
+	if (!page) {
+		page = vmalloc_user(PAGE_SIZE);
+		if (!page) {
+			return -ENOMEM;
+		}
+		spin_lock(&data->flag_lock);
+		if (data->regs_page) {
+			spin_unlock(&data->flag_lock);
+			vfree(page);
+			page = data->regs_page;
+		} else {
+			if (data->stopped_flag && data->stopped_task) {
+				bp_regs_fill(page, data->stopped_task);
+			}
+			smp_store_release(&data->regs_page, page);
+			spin_unlock(&data->flag_lock);
+		}
+	}
+	return remap_vmalloc_range(vma, page, 0);
+}
+
+static int rwmem_bp_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct rwmem_bp_private_data *data = filp->private_data;
+	struct rwmem_ring *ring = smp_load_acquire(&data->ring);
+
+	if (vma->vm_pgoff == RWMEM_BP_REGS_PGOFF) {
+		return bp_regs_mmap(data, vma);
+	}
+	if (!ring || vma->vm_pgoff != 0) {
+		return -EINVAL;
+	}
+	return rwmem_ring_mmap(ring, vma);
+}
+
 static const struct file_operations rwmem_bp_fops = {
 	.owner = THIS_MODULE,
 
 	.llseek = no_llseek,
 	.poll = rwmem_bp_poll,
 	.read = rwmem_bp_read,
+	.mmap = rwmem_bp_mmap,
 	.unlocked_ioctl = rwmem_bp_ioctl,
 	.release = rwmem_bp_release,
 	.fasync = rwmem_bp_fasync,
@@ -339,8 +1535,124 @@ struct file *create_rwmem_bp_file(void)
 {
 	struct rwmem_bp_private_data *data =
 		kzalloc(sizeof(struct rwmem_bp_private_data), GFP_KERNEL);
+	struct file *file;
+	if (!data) {
+		return ERR_PTR(-ENOMEM);
+	}
+	refcount_set(&data->ref, 1);
 	init_waitqueue_head(&data->wq);
 	init_waitqueue_head(&data->poll_wq);
 	spin_lock_init(&data->flag_lock);
-	return anon_inode_getfile("[bp_handle]", &rwmem_bp_fops, data, O_RDWR);
+	mutex_init(&data->events_lock);
+	file = anon_inode_getfile("[bp_handle]", &rwmem_bp_fops, data, O_RDWR);
+	if (IS_ERR(file)) {
+		kfree(data);
+	}
+	return file;
+}
+
+static int rwmem_bp_add_event(struct file *file, struct perf_event_attr *attr,
+			      struct task_struct *task)
+{
+	struct rwmem_bp_private_data *data = file->private_data;
+	struct perf_event *bp;
+
+	// bp_callback untags the file pointer from the context
+	bp = perf_event_create_kernel_counter(
+		attr, -1, task, bp_callback,
+		(void *)(((uint64_t)file & ~((uint64_t)~((uint8_t)0xcb) << 56))));
+	if (IS_ERR(bp)) {
+		return PTR_ERR(bp);
+	}
+	data->events[data->nr_events++] = bp;
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+// Create the perf events of the bp on every thread of the thread group
+static int bp_install_process(struct file *file, struct perf_event_attr *attr)
+{
+	struct rwmem_bp_private_data *data = file->private_data;
+	struct task_struct *leader = data->target_task;
+	unsigned int nr_tasks, max_tasks, nr_events, i;
+	struct task_struct **tasks, *t;
+	struct perf_event **events;
+	int ret = 0;
+
+	data->process = true;
+	attr->inherit = 1;
+	attr->inherit_thread = 1;
+
+	// Threads cloned by a thread which has the event inherit it. One
+	// cloned before can only be found by walking the threads again, until
+	// a walk finds none without an event.
+	do {
+		nr_events = data->nr_events;
+		max_tasks = get_nr_threads(leader);
+		tasks = kcalloc(max_tasks, sizeof(*tasks), GFP_KERNEL);
+		events = krealloc(data->events,
+				  (nr_events + max_tasks) * sizeof(*events),
+				  GFP_KERNEL);
+		if (!tasks || !events) {
+			kfree(tasks);
+			return -ENOMEM;
+		}
+		data->events = events;
+		nr_tasks = 0;
+		rcu_read_lock();
+		for_each_thread (leader, t) {
+			if (nr_tasks == max_tasks) {
+				break;
+			}
+			for (i = 0; i < nr_events; i++) {
+				if (events[i]->hw.target == t) {
+					break;
+				}
+			}
+			if (i == nr_events) {
+				get_task_struct(t);
+				tasks[nr_tasks++] = t;
+			}
+		}
+		rcu_read_unlock();
+
+		for (i = 0; i < nr_tasks; i++) {
+			// a thread which exited meanwhile is not an error
+			if (!ret) {
+				ret = rwmem_bp_add_event(file, attr, tasks[i]);
+				if (ret == -ESRCH) {
+					ret = 0;
+				}
+			}
+			put_task_struct(tasks[i]);
+		}
+		kfree(tasks);
+	} while (!ret && data->nr_events != nr_events);
+	if (!ret && !data->nr_events) {
+		ret = -ESRCH;
+	}
+	return ret;
+}
+#endif
+
+// Create the perf events of the bp, on the target task only or on every
+// thread of its thread group
+int rwmem_bp_install(struct file *file, struct perf_event_attr *attr,
+		     bool process)
+{
+	struct rwmem_bp_private_data *data = file->private_data;
+
+	if (!process) {
+		data->events = kcalloc(1, sizeof(*data->events), GFP_KERNEL);
+		if (!data->events) {
+			return -ENOMEM;
+		}
+		return rwmem_bp_add_event(file, attr, data->target_task);
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+	return bp_install_process(file, attr);
+#else
+	// without inherit_thread the child processes would inherit the events
+	return -EOPNOTSUPP;
+#endif
 }
\ No newline at end of file
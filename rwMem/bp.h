@@ -2,11 +2,46 @@
 #define _KERNEL_RWMEM_BP_H_
 
 #include "linux/perf_event.h"
+#include "linux/task_work.h"
+#include "linux/types.h"
 #include "linux/fs.h"
+#include "linux/hw_breakpoint.h"
+#include "linux/mutex.h"
+#include "linux/refcount.h"
 #include "linux/spinlock_types.h"
+#include "asm/ptrace.h"
+#include "bp_action.h"
+#include "bp_aggr.h"
+#include "bp_cond.h"
+#include "bp_queue.h"
+#include "bp_ring.h"
+#include "bp_stack.h"
 
 #define RWMEM_BP_MAJOR_NUM 101
 
+// flags of IOCTL_ADD_BP
+#define RWMEM_BP_FLAG_DISABLED 0x1 // create the bp disabled, see IOCTL_BP_ENABLE
+// watch every thread of the thread group, from Linux 5.13 on. Such a bp can
+// not be created disabled, nor be modified, enabled or disabled later
+// (-EOPNOTSUPP)
+#define RWMEM_BP_FLAG_PROCESS 0x2
+// watch range_len bytes instead of len, see rwmem_bp_range()
+#define RWMEM_BP_FLAG_RANGE 0x4
+
+// the largest block an arm64 watchpoint can cover with its address mask
+#define RWMEM_BP_MAX_RANGE (1UL << 31)
+
+#define RWMEM_BP_MODE_STOP 0 // stop the thread on every hit
+#define RWMEM_BP_MODE_LOG 1 // record the hit into the ring buffer and go on
+#define RWMEM_BP_MODE_AGGR 2 // count the hit per pc and go on
+#define RWMEM_BP_MODE_ACTION 3 // run the actions of the bp and go on
+#define RWMEM_BP_MODE_STACK 4 // count the hit per user call stack and go on
+
+// register ids are the same as in IOCTL_BP_SET_REG: x0-x30, sp, pc, pstate
+#define RWMEM_BP_NUM_REGS 34
+// pseudo register holding the accessed address (pc for execute bps)
+#define RWMEM_BP_REG_ADDR 34
+
 struct set_reg_param {
 	uint64_t id;
 	uint64_t value;
@@ -16,20 +51,221 @@ struct set_simd_reg_param {
 	__uint128_t value;
 };
 
+struct bp_log_param {
+	uint64_t reg_mask; // registers to record, bit n for register id n
+	uint32_t mem_reg; // base register of the memory to record
+	uint32_t mem_len; // bytes of memory to record, 0 for none
+	int64_t mem_offset; // added to the value of mem_reg
+	uint32_t ring_pages; // data pages of the ring buffer, a power of two
+	uint32_t flags; // RWMEM_BP_LOG_*
+};
+
+// Record the memory a second time once the instruction which hit has run,
+// the new value follows the old one in the record. Logpoints only.
+#define RWMEM_BP_LOG_NEW_VALUE 0x1
+// the most memory a logpoint with RWMEM_BP_LOG_NEW_VALUE records
+#define RWMEM_BP_LOG_VALUE_MAX 64
+
+#define RWMEM_BP_STEP_N 0 // step count instructions
+#define RWMEM_BP_STEP_UNTIL 1 // step until the pc is in [start, end)
+#define RWMEM_BP_STEP_OUT 2 // step until the function returns to the lr
+#define RWMEM_BP_STEP_WHILE 3 // step while the pc is in [start, end)
+
+// record every stepped instruction into the ring set by IOCTL_BP_SET_TRACE
+#define RWMEM_BP_STEP_FLAG_TRACE 0x1
+
+struct bp_step_param {
+	uint32_t mode;
+	uint32_t flags;
+	// instructions for RWMEM_BP_STEP_N, the most instructions to step for
+	// the other modes, 0 for no limit
+	uint64_t count;
+	uint64_t start;
+	uint64_t end;
+};
+
+// kind of bp_reg_write, ids are those of IOCTL_BP_SET_REG and
+// IOCTL_BP_SET_SIMD_REG
+#define RWMEM_BP_REG_GPR 0
+#define RWMEM_BP_REG_SIMD 1
+// every GPR and SIMD register once
+#define RWMEM_BP_MAX_REG_WRITES 68
+
+struct bp_reg_write {
+	uint32_t kind;
+	uint32_t id;
+	uint64_t reserved;
+	__uint128_t value; // GPRs use the low 64 bits
+};
+
+// action of bp_resume_param
+#define RWMEM_BP_RESUME_CONTINUE 0
+#define RWMEM_BP_RESUME_STEP 1 // step as described by step
+
+struct bp_resume_param {
+	uint64_t writes; // user pointer to count bp_reg_write
+	uint32_t count;
+	uint32_t action;
+	struct bp_step_param step;
+};
+
+// mmap offset of the register page, offset 0 is the ring buffer
+#define RWMEM_BP_REGS_PGOFF 1
+
+// dirty flags of rwmem_bp_regs_page, set by userspace
+#define RWMEM_BP_REGS_DIRTY_GPR 0x1
+#define RWMEM_BP_REGS_DIRTY_SIMD 0x2
+
+// The registers of the stopped thread, filled before the stop is signalled.
+// Registers changed in the page are applied on continue if the matching
+// dirty flag is set, the kernel clears the flags at every stop.
+struct rwmem_bp_regs_page {
+	uint32_t seq; // incremented at every stop
+	int32_t tid; // the stopped thread
+	uint32_t dirty;
+	uint32_t reserved;
+	struct user_pt_regs regs;
+	struct user_fpsimd_state fpsimd;
+};
+
+// parameter of IOCTL_ADD_BP, range_len is only read with RWMEM_BP_FLAG_RANGE
+struct bp_add_param {
+	pid_t pid;
+	uint8_t type;
+	uint8_t len;
+	uint8_t flags;
+	size_t virt_addr;
+	size_t range_len;
+};
+
+#define RWMEM_BP_BATCH_MAX 1024
+// flags of bp_batch_param
+#define RWMEM_BP_BATCH_ATOMIC 0x1 // create all bps or none
+
+struct bp_batch_entry {
+	struct bp_add_param bp;
+	int32_t result; // out: the fd or -errno, -ECANCELED if undone or not tried
+	uint32_t reserved;
+};
+
+struct bp_batch_param {
+	uint64_t entries; // user pointer to count struct bp_batch_entry
+	uint32_t count;
+	uint32_t flags;
+};
+
+// the address part of IOCTL_ADD_BP, flags may be RWMEM_BP_FLAG_DISABLED and
+// RWMEM_BP_FLAG_RANGE
+struct bp_modify_param {
+	uint8_t type;
+	uint8_t flags;
+	uint16_t reserved;
+	uint32_t len;
+	uint64_t virt_addr;
+	uint64_t range_len;
+};
+
+struct bp_pool_stats {
+	uint32_t size;
+	uint32_t in_use; // threads which are stopped or about to stop
+	uint64_t exhausted; // stops dropped because the pool was empty
+};
+
+struct bp_hit_policy {
+	uint64_t ignore_count; // hits to skip before the first one is handled
+	uint64_t every_n; // then handle every nth hit, 0 or 1 for all
+};
+
+// A record in the mmap'd ring buffer of a logpoint or an instruction trace.
+// It is followed by the registers selected in reg_mask (in ascending order)
+// and mem_len bytes of memory, padded to 8 bytes. A trace writes a record
+// after each stepped instruction, with the next pc in both pc and addr.
+// With RWMEM_BP_LOG_NEW_VALUE the memory after the instruction follows,
+// another mem_len bytes, and mem_valid counts bytes read both times.
+struct rwmem_bp_record {
+	uint64_t time;
+	int32_t tid;
+	uint32_t mem_valid; // bytes of memory that could be read
+	uint64_t pc;
+	uint64_t addr;
+};
+
 #define IOCTL_BP_CONTINUE _IO(RWMEM_BP_MAJOR_NUM, 0)
 #define IOCTL_BP_SET_REG _IOW(RWMEM_BP_MAJOR_NUM, 1, struct set_reg_param)
 #define IOCTL_BP_SET_SIMD_REG                                                  \
 	_IOW(RWMEM_BP_MAJOR_NUM, 2, struct set_simd_reg_param)
 #define IOCTL_BP_STEP _IO(RWMEM_BP_MAJOR_NUM, 3)
+// returns the tid of the stopped thread, 0 if no thread is stopped
 #define IOCTL_BP_IS_STOPPED _IO(RWMEM_BP_MAJOR_NUM, 4)
+#define IOCTL_BP_ENABLE _IO(RWMEM_BP_MAJOR_NUM, 5)
+#define IOCTL_BP_SET_LOG _IOW(RWMEM_BP_MAJOR_NUM, 6, struct bp_log_param)
+#define IOCTL_BP_SET_COND _IOW(RWMEM_BP_MAJOR_NUM, 7, struct bp_cond_param)
+#define IOCTL_BP_SET_HIT_POLICY                                                \
+	_IOW(RWMEM_BP_MAJOR_NUM, 8, struct bp_hit_policy)
+#define IOCTL_BP_GET_HIT_COUNT _IOR(RWMEM_BP_MAJOR_NUM, 9, uint64_t)
+// switch to RWMEM_BP_MODE_AGGR with a table of the given capacity
+#define IOCTL_BP_SET_AGGR _IOW(RWMEM_BP_MAJOR_NUM, 10, uint32_t)
+// returns the number of entries copied
+#define IOCTL_BP_READ_AGGR                                                     \
+	_IOWR(RWMEM_BP_MAJOR_NUM, 11, struct bp_aggr_read_param)
+// step until the condition is met, the thread only stops then
+#define IOCTL_BP_STEP_EX _IOW(RWMEM_BP_MAJOR_NUM, 12, struct bp_step_param)
+// allocate the ring of RWMEM_BP_STEP_FLAG_TRACE without leaving stop mode
+#define IOCTL_BP_SET_TRACE _IOW(RWMEM_BP_MAJOR_NUM, 13, struct bp_log_param)
+#define IOCTL_BP_GET_POOL_STATS                                                \
+	_IOR(RWMEM_BP_MAJOR_NUM, 14, struct bp_pool_stats)
+#define IOCTL_BP_SET_QUEUE _IOW(RWMEM_BP_MAJOR_NUM, 15, struct bp_queue_param)
+// write registers of the stopped thread and resume it, nothing is written
+// if any of the writes is invalid
+#define IOCTL_BP_RESUME _IOW(RWMEM_BP_MAJOR_NUM, 16, struct bp_resume_param)
+// switch to RWMEM_BP_MODE_ACTION, or back to stop mode without actions
+#define IOCTL_BP_SET_ACTIONS                                                   \
+	_IOW(RWMEM_BP_MAJOR_NUM, 17, struct bp_action_param)
+#define IOCTL_BP_DISABLE _IO(RWMEM_BP_MAJOR_NUM, 18)
+// move a hardware bp in place, the perf events are kept
+#define IOCTL_BP_MODIFY _IOW(RWMEM_BP_MAJOR_NUM, 19, struct bp_modify_param)
+// switch to RWMEM_BP_MODE_STACK with a table of the given size
+#define IOCTL_BP_SET_STACKS _IOW(RWMEM_BP_MAJOR_NUM, 20, struct bp_stack_param)
+// returns the number of entries copied
+#define IOCTL_BP_READ_STACKS                                                   \
+	_IOWR(RWMEM_BP_MAJOR_NUM, 21, struct bp_stack_read_param)
 
 void bp_callback(struct perf_event *perf, struct perf_sample_data *sample_data,
 		 struct pt_regs *regs);
 int rwmem_bp_step_handler(struct pt_regs *regs, unsigned long esr);
 
+struct rwmem_swbp;
+struct rwmem_swwp;
+struct rwmem_bp_private_data;
+
+// The resume task which stops a thread. They come from a pool in the bp, so
+// a hit never allocates. One thread needs at most one at a time.
+#define RWMEM_BP_HIT_POOL_SIZE 64
+
+struct hit_bp_cb {
+	struct callback_head twork;
+	struct rwmem_bp_private_data *data;
+};
+
 struct rwmem_bp_private_data {
-	struct perf_event *event;
+	refcount_t ref; // the file and every pending stop hold a reference
+	bool released; // the file is closed, pending stops are dropped
+	// one event per thread, threads created later inherit one of them
+	struct perf_event **events;
+	unsigned int nr_events;
+	// the events are inherited, see RWMEM_BP_FLAG_PROCESS. The inherited
+	// copies are out of reach, so they can not be modified or re-armed
+	bool process;
+	struct mutex events_lock; // serializes IOCTL_BP_MODIFY
 	struct task_struct *target_task;
+	struct rwmem_swwp *swwp; // set for a software watchpoint
+	struct rwmem_swbp *swbp; // set for a software breakpoint
+	// hits outside [range_start, range_end) of a masked watchpoint are
+	// ignored, range_end is 0 if the whole watchpoint is watched
+	unsigned long range_start;
+	unsigned long range_end;
+	// the thread which is stopped now, others wait for it to continue
+	struct task_struct *stopped_task;
 	struct wait_queue_head wq;
 	struct wait_queue_head poll_wq;
 	atomic_t poll;
@@ -37,7 +273,74 @@ struct rwmem_bp_private_data {
 	struct spinlock flag_lock;
 	bool continue_flag;
 	bool stopped_flag;
+	uint8_t mode;
+	struct bp_log_param log;
+	struct rwmem_ring *ring;
+	struct rwmem_bp_regs_page *regs_page; // allocated by the first mmap
+	struct rwmem_bp_aggr *aggr;
+	struct rwmem_bp_stacks *stacks;
+	struct rwmem_bp_cond __rcu *cond;
+	struct rwmem_bp_actions __rcu *actions;
+	struct rwmem_bp_queue_link __rcu *queue;
+	struct hit_bp_cb hit_pool[RWMEM_BP_HIT_POOL_SIZE];
+	DECLARE_BITMAP(hit_pool_used, RWMEM_BP_HIT_POOL_SIZE);
+	atomic64_t hit_pool_exhausted;
+	atomic64_t hits; // hits which passed the condition
+	uint64_t ignore_count;
+	uint64_t every_n;
 };
 
 struct file *create_rwmem_bp_file(void);
+int rwmem_bp_install(struct file *file, struct perf_event_attr *attr,
+		     bool process);
+void rwmem_bp_hit(struct rwmem_bp_private_data *data, struct pt_regs *regs,
+		  unsigned long addr);
+void rwmem_bp_put(struct rwmem_bp_private_data *data);
+
+static inline unsigned long bp_access_addr(struct perf_event *perf,
+					   struct pt_regs *regs)
+{
+	if (perf->attr.bp_type == HW_BREAKPOINT_X) {
+		return regs->pc;
+	}
+	return counter_arch_bp(perf)->trigger;
+}
+
+// Find the watchpoint which covers [addr, addr + len). Ranges within one
+// doubleword use the byte select, larger ones the smallest naturally aligned
+// power-of-two block around them, which needs patch/watchpoint_mask.patch.
+static inline int rwmem_bp_range(unsigned long addr, size_t len,
+				 uint64_t *bp_addr, uint64_t *bp_len)
+{
+	unsigned long end = addr + len;
+	unsigned long size = 8;
+
+	if (!len || end < addr) {
+		return -EINVAL;
+	}
+	if ((addr & ~7UL) + 8 >= end) {
+		*bp_addr = addr;
+		*bp_len = len;
+		return 0;
+	}
+	while ((addr & ~(size - 1)) + size < end) {
+		if (size == RWMEM_BP_MAX_RANGE) {
+			return -EINVAL;
+		}
+		size <<= 1;
+	}
+	*bp_addr = addr & ~(size - 1);
+	*bp_len = size;
+	return 0;
+}
+
+static inline uint64_t bp_reg_value(struct pt_regs *regs, uint32_t id,
+				    unsigned long addr)
+{
+	if (id == RWMEM_BP_REG_ADDR) {
+		return addr;
+	}
+	// x0-x30, sp, pc and pstate are laid out contiguously
+	return ((uint64_t *)&regs->user_regs)[id];
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "bp_action.h"
+#include "api_proxy.h"
+#include "bp.h"
+#include "linux/slab.h"
+#include "linux/uaccess.h"
+
+static bool rwmem_bp_action_valid(const struct bp_action *action)
+{
+	switch (action->op) {
+	case RWMEM_BP_ACT_SET_REG:
+	case RWMEM_BP_ACT_ADD_REG:
+		// pstate is never written, pc is
+		return action->reg < 33;
+	case RWMEM_BP_ACT_WRITE_MEM:
+		return action->reg <= RWMEM_BP_REG_ADDR && action->len &&
+		       action->len <= RWMEM_BP_ACTION_MAX_WRITE;
+	case RWMEM_BP_ACT_SET_PC:
+		return action->reg < 33 || action->reg == RWMEM_BP_ACT_NO_REG;
+	default:
+		return false;
+	}
+}
+
+struct rwmem_bp_actions *
+rwmem_bp_actions_create(const struct bp_action_param *param)
+{
+	struct rwmem_bp_actions *actions;
+	uint32_t i;
+
+	if (!param->count || param->count > RWMEM_BP_ACTION_MAX ||
+	    param->flags) {
+		return ERR_PTR(-EINVAL);
+	}
+	actions = kzalloc(struct_size(actions, actions, param->count),
+			  GFP_KERNEL);
+	if (!actions) {
+		return ERR_PTR(-ENOMEM);
+	}
+	actions->count = param->count;
+	if (x_copy_from_user(actions->actions, (void __user *)param->actions,
+			     param->count * sizeof(struct bp_action))) {
+		kfree(actions);
+		return ERR_PTR(-EFAULT);
+	}
+
+	for (i = 0; i < actions->count; i++) {
+		if (!rwmem_bp_action_valid(&actions->actions[i])) {
+			kfree(actions);
+			return ERR_PTR(-EINVAL);
+		}
+	}
+	return actions;
+}
+
+int rwmem_bp_actions_run(const struct rwmem_bp_actions *actions,
+			 struct pt_regs *regs, unsigned long addr)
+{
+	uint64_t *gprs = (uint64_t *)&regs->user_regs;
+	unsigned long base;
+	int ret = 0;
+	uint32_t i;
+
+	// actions run in order, a later one sees the registers of earlier ones
+	for (i = 0; i < actions->count; i++) {
+		const struct bp_action *action = &actions->actions[i];
+
+		switch (action->op) {
+		case RWMEM_BP_ACT_SET_REG:
+			gprs[action->reg] = action->value;
+			break;
+		case RWMEM_BP_ACT_ADD_REG:
+			gprs[action->reg] += action->value;
+			break;
+		case RWMEM_BP_ACT_WRITE_MEM:
+			// little endian, the low len bytes of value are written
+			base = bp_reg_value(regs, action->reg, addr) +
+			       action->offset;
+			if (copy_to_user_nofault((void __user *)base,
+						 &action->value, action->len)) {
+				ret = -EFAULT;
+			}
+			break;
+		case RWMEM_BP_ACT_SET_PC:
+			regs->pc = action->offset;
+			if (action->reg != RWMEM_BP_ACT_NO_REG) {
+				regs->pc += gprs[action->reg];
+			}
+			break;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,47 @@
+#ifndef _KERNEL_RWMEM_BP_ACTION_H_
+#define _KERNEL_RWMEM_BP_ACTION_H_
+
+#include "linux/rcupdate.h"
+#include "linux/types.h"
+#include "asm/ptrace.h"
+
+#define RWMEM_BP_ACTION_MAX 16
+#define RWMEM_BP_ACTION_MAX_WRITE 8
+
+// op of an action
+#define RWMEM_BP_ACT_SET_REG 0 // reg = value
+#define RWMEM_BP_ACT_ADD_REG 1 // reg += value
+#define RWMEM_BP_ACT_WRITE_MEM 2 // write len bytes of value at reg + offset
+#define RWMEM_BP_ACT_SET_PC 3 // pc = reg + offset, or offset without reg
+
+// reg of RWMEM_BP_ACT_SET_PC for an absolute target
+#define RWMEM_BP_ACT_NO_REG 0xff
+
+struct bp_action {
+	uint8_t op;
+	uint8_t reg; // x0-x30, sp, pc, or RWMEM_BP_REG_ADDR as a base
+	uint8_t len;
+	uint8_t reserved[5];
+	int64_t offset;
+	uint64_t value;
+};
+
+struct bp_action_param {
+	uint32_t count; // 0 removes the actions and returns to stop mode
+	uint32_t flags;
+	uint64_t actions; // user pointer to count struct bp_action
+};
+
+struct rwmem_bp_actions {
+	struct rcu_head rcu;
+	uint32_t count;
+	struct bp_action actions[];
+};
+
+struct rwmem_bp_actions *
+rwmem_bp_actions_create(const struct bp_action_param *param);
+// may be called from exception context, returns -EFAULT if a write failed
+int rwmem_bp_actions_run(const struct rwmem_bp_actions *actions,
+			 struct pt_regs *regs, unsigned long addr);
+
+#endif
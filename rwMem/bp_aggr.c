@@ -0,0 +1,161 @@
+#include "bp_aggr.h"
+#include "api_proxy.h"
+#include "linux/hash.h"
+#include "linux/log2.h"
+#include "linux/overflow.h"
+#include "linux/slab.h"
+#include "linux/spinlock.h"
+#include "linux/vmalloc.h"
+
+struct rwmem_bp_aggr *rwmem_bp_aggr_alloc(uint32_t capacity)
+{
+	struct rwmem_bp_aggr *aggr;
+
+	if (!capacity || capacity > RWMEM_BP_AGGR_MAX_ENTRIES) {
+		return ERR_PTR(-EINVAL);
+	}
+	aggr = kzalloc(sizeof(*aggr), GFP_KERNEL);
+	if (!aggr) {
+		return ERR_PTR(-ENOMEM);
+	}
+	if (rwmem_bp_table_init(&aggr->table, roundup_pow_of_two(capacity),
+				sizeof(struct rwmem_bp_aggr_entry))) {
+		kfree(aggr);
+		return ERR_PTR(-ENOMEM);
+	}
+	return aggr;
+}
+
+void rwmem_bp_aggr_free(struct rwmem_bp_aggr *aggr)
+{
+	rwmem_bp_table_destroy(&aggr->table);
+	kfree(aggr);
+}
+
+void rwmem_bp_aggr_add(struct rwmem_bp_aggr *aggr, struct pt_regs *regs,
+		       unsigned long addr)
+{
+	uint32_t mask = (1U << aggr->table.bits) - 1;
+	uint32_t i = hash_64(regs->pc, aggr->table.bits);
+	struct rwmem_bp_aggr_entry *entry;
+	unsigned long flags;
+	uint32_t n;
+
+	raw_spin_lock_irqsave(&aggr->table.lock, flags);
+	// a pc is never 0 for a user space hit, so 0 marks a free slot
+	for (n = 0; n <= mask; n++, i = (i + 1) & mask) {
+		entry = (struct rwmem_bp_aggr_entry *)aggr->table.rows + i;
+		if (entry->pc == regs->pc) {
+			break;
+		}
+		if (!entry->pc) {
+			entry->pc = regs->pc;
+			entry->first_addr = addr;
+			aggr->table.count++;
+			break;
+		}
+	}
+	if (n > mask) {
+		aggr->table.dropped++;
+		raw_spin_unlock_irqrestore(&aggr->table.lock, flags);
+		return;
+	}
+	entry->hits++;
+	entry->last_tid = current->pid;
+	memcpy(entry->regs, &regs->user_regs, sizeof(entry->regs));
+	raw_spin_unlock_irqrestore(&aggr->table.lock, flags);
+}
+
+int rwmem_bp_table_init(struct rwmem_bp_table *table, uint32_t capacity,
+			size_t row_size)
+{
+	table->rows = vzalloc(array_size(row_size, capacity));
+	if (!table->rows) {
+		return -ENOMEM;
+	}
+	table->bits = ilog2(capacity);
+	table->row_size = row_size;
+	raw_spin_lock_init(&table->lock);
+	return 0;
+}
+
+void rwmem_bp_table_destroy(struct rwmem_bp_table *table)
+{
+	vfree(table->rows);
+}
+
+long rwmem_bp_table_read(struct rwmem_bp_table *table,
+			 bool (*used)(const void *row), uint64_t user_rows,
+			 uint32_t max_rows, bool reset, uint64_t *dropped)
+{
+	uint32_t max = min(max_rows, 1U << table->bits);
+	size_t row_size = table->row_size;
+	void *buf, *row, *rows = NULL;
+	uint32_t i, copied = 0;
+	unsigned long flags;
+
+	buf = vmalloc(array_size(row_size, max ? max : 1));
+	if (!buf) {
+		return -ENOMEM;
+	}
+	// a reset swaps in empty rows and reads the old ones after unlocking
+	if (reset) {
+		rows = vzalloc(row_size << table->bits);
+		if (!rows) {
+			vfree(buf);
+			return -ENOMEM;
+		}
+	}
+	raw_spin_lock_irqsave(&table->lock, flags);
+	// the rows which do not fit would be lost
+	if (reset && table->count > max) {
+		raw_spin_unlock_irqrestore(&table->lock, flags);
+		vfree(rows);
+		vfree(buf);
+		return -ENOSPC;
+	}
+	*dropped = table->dropped;
+	if (reset) {
+		swap(table->rows, rows);
+		table->count = 0;
+		table->dropped = 0;
+		raw_spin_unlock_irqrestore(&table->lock, flags);
+	}
+	// without a reset the table is snapshotted under the lock,
+	// userspace can not be written with it held
+	for (i = 0; i < (1U << table->bits) && copied < max; i++) {
+		row = (reset ? rows : table->rows) + i * row_size;
+		if (used(row)) {
+			memcpy(buf + copied++ * row_size, row, row_size);
+		}
+	}
+	if (reset) {
+		vfree(rows);
+	} else {
+		raw_spin_unlock_irqrestore(&table->lock, flags);
+	}
+
+	if (x_copy_to_user((void __user *)user_rows, buf, row_size * copied)) {
+		vfree(buf);
+		return -EFAULT;
+	}
+	vfree(buf);
+	return copied;
+}
+
+static bool aggr_row_used(const void *row)
+{
+	const struct rwmem_bp_aggr_entry *entry = row;
+
+	return entry->pc;
+}
+
+// Copy the used slots to userspace, returns the number of entries copied
+long rwmem_bp_aggr_read(struct rwmem_bp_aggr *aggr,
+			struct bp_aggr_read_param *param)
+{
+	return rwmem_bp_table_read(&aggr->table, aggr_row_used,
+				   param->entries, param->max_entries,
+				   param->flags & RWMEM_BP_AGGR_RESET,
+				   &param->dropped);
+}
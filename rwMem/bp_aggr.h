@@ -0,0 +1,66 @@
+#ifndef _KERNEL_RWMEM_BP_AGGR_H_
+#define _KERNEL_RWMEM_BP_AGGR_H_
+
+#include "linux/spinlock_types.h"
+#include "linux/types.h"
+#include "asm/ptrace.h"
+
+#define RWMEM_BP_AGGR_MAX_ENTRIES 16384
+
+// flags of bp_aggr_read_param
+// empty the table after reading it, fails with ENOSPC and leaves the table
+// alone if its rows do not fit into max_entries
+#define RWMEM_BP_AGGR_RESET 0x1
+
+// One row per unique pc which hit the bp
+struct rwmem_bp_aggr_entry {
+	uint64_t pc;
+	uint64_t hits;
+	uint64_t first_addr; // the accessed address of the first hit
+	int32_t last_tid;
+	uint32_t reserved;
+	uint64_t regs[34]; // x0-x30, sp, pc and pstate of the last hit
+};
+
+struct bp_aggr_read_param {
+	uint64_t entries; // user pointer to max_entries entries
+	uint32_t max_entries;
+	uint32_t flags;
+	uint64_t dropped; // out: hits of pcs which did not fit into the table
+};
+
+// An open addressing hash table. The rows are only accessed with the lock
+// held, a reset replaces them.
+struct rwmem_bp_table {
+	raw_spinlock_t lock;
+	uint32_t bits;
+	uint32_t count;
+	uint64_t dropped;
+	size_t row_size;
+	void *rows;
+};
+
+// A table keyed by pc, it never shrinks until it is reset
+struct rwmem_bp_aggr {
+	struct rwmem_bp_table table; // of struct rwmem_bp_aggr_entry
+};
+
+// capacity is rounded up to a power of two
+struct rwmem_bp_aggr *rwmem_bp_aggr_alloc(uint32_t capacity);
+void rwmem_bp_aggr_free(struct rwmem_bp_aggr *aggr);
+// may be called from exception context
+void rwmem_bp_aggr_add(struct rwmem_bp_aggr *aggr, struct pt_regs *regs,
+		       unsigned long addr);
+long rwmem_bp_aggr_read(struct rwmem_bp_aggr *aggr,
+			struct bp_aggr_read_param *param);
+// capacity is a power of two
+int rwmem_bp_table_init(struct rwmem_bp_table *table, uint32_t capacity,
+			size_t row_size);
+void rwmem_bp_table_destroy(struct rwmem_bp_table *table);
+// Copy the used rows of a table to the user array, returns the number of
+// rows copied. used tells a row in use from a free one.
+long rwmem_bp_table_read(struct rwmem_bp_table *table,
+			 bool (*used)(const void *row), uint64_t user_rows,
+			 uint32_t max_rows, bool reset, uint64_t *dropped);
+
+#endif
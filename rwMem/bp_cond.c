@@ -0,0 +1,105 @@
+#include "bp_cond.h"
+#include "api_proxy.h"
+#include "bp.h"
+#include "linux/slab.h"
+#include "linux/uaccess.h"
+
+struct rwmem_bp_cond *rwmem_bp_cond_create(const struct bp_cond_param *param)
+{
+	struct rwmem_bp_cond *cond;
+	uint32_t i;
+
+	if (param->count > RWMEM_BP_COND_MAX_TERMS ||
+	    param->flags & ~RWMEM_BP_COND_ANY) {
+		return ERR_PTR(-EINVAL);
+	}
+	cond = kzalloc(struct_size(cond, terms, param->count), GFP_KERNEL);
+	if (!cond) {
+		return ERR_PTR(-ENOMEM);
+	}
+	cond->count = param->count;
+	cond->flags = param->flags;
+	if (x_copy_from_user(cond->terms, (void __user *)param->terms,
+			     param->count * sizeof(struct bp_cond_term))) {
+		kfree(cond);
+		return ERR_PTR(-EFAULT);
+	}
+
+	for (i = 0; i < cond->count; i++) {
+		struct bp_cond_term *term = &cond->terms[i];
+		if (term->reg > RWMEM_BP_REG_ADDR ||
+		    term->op > RWMEM_BP_COND_TEST) {
+			kfree(cond);
+			return ERR_PTR(-EINVAL);
+		}
+		if (term->deref_size != 0 && term->deref_size != 1 &&
+		    term->deref_size != 2 && term->deref_size != 4 &&
+		    term->deref_size != 8) {
+			kfree(cond);
+			return ERR_PTR(-EINVAL);
+		}
+	}
+	return cond;
+}
+
+static bool rwmem_bp_cond_term_eval(const struct bp_cond_term *term,
+				    struct pt_regs *regs, unsigned long addr)
+{
+	uint64_t x = bp_reg_value(regs, term->reg, addr);
+
+	if (term->deref_size) {
+		uint64_t mem = 0;
+		// called from the debug exception, the target page must not be
+		// faulted in here
+		if (copy_from_user_nofault(&mem,
+					   (void __user *)(x + term->offset),
+					   term->deref_size)) {
+			return false;
+		}
+		x = mem;
+	}
+	x &= term->mask;
+
+	switch (term->op) {
+	case RWMEM_BP_COND_EQ:
+		return x == term->value;
+	case RWMEM_BP_COND_NE:
+		return x != term->value;
+	case RWMEM_BP_COND_LT:
+		return x < term->value;
+	case RWMEM_BP_COND_LE:
+		return x <= term->value;
+	case RWMEM_BP_COND_GT:
+		return x > term->value;
+	case RWMEM_BP_COND_GE:
+		return x >= term->value;
+	case RWMEM_BP_COND_SLT:
+		return (int64_t)x < (int64_t)term->value;
+	case RWMEM_BP_COND_SLE:
+		return (int64_t)x <= (int64_t)term->value;
+	case RWMEM_BP_COND_SGT:
+		return (int64_t)x > (int64_t)term->value;
+	case RWMEM_BP_COND_SGE:
+		return (int64_t)x >= (int64_t)term->value;
+	case RWMEM_BP_COND_TEST:
+		return (x & term->value) != 0;
+	default:
+		return false;
+	}
+}
+
+bool rwmem_bp_cond_eval(const struct rwmem_bp_cond *cond,
+			struct pt_regs *regs, unsigned long addr)
+{
+	bool any = cond->flags & RWMEM_BP_COND_ANY;
+	uint32_t i;
+
+	for (i = 0; i < cond->count; i++) {
+		bool res = rwmem_bp_cond_term_eval(&cond->terms[i], regs, addr);
+		if (res == any) {
+			return res;
+		}
+	}
+	// all terms true (all) or none true (any), an empty program is true
+	return !any || cond->count == 0;
+}
@@ -0,0 +1,53 @@
+#ifndef _KERNEL_RWMEM_BP_COND_H_
+#define _KERNEL_RWMEM_BP_COND_H_
+
+#include "linux/rcupdate.h"
+#include "linux/types.h"
+#include "asm/ptrace.h"
+
+#define RWMEM_BP_COND_MAX_TERMS 16
+
+// comparison of a term, operand & mask is compared with value
+#define RWMEM_BP_COND_EQ 0
+#define RWMEM_BP_COND_NE 1
+#define RWMEM_BP_COND_LT 2 // unsigned
+#define RWMEM_BP_COND_LE 3
+#define RWMEM_BP_COND_GT 4
+#define RWMEM_BP_COND_GE 5
+#define RWMEM_BP_COND_SLT 6 // signed
+#define RWMEM_BP_COND_SLE 7
+#define RWMEM_BP_COND_SGT 8
+#define RWMEM_BP_COND_SGE 9
+#define RWMEM_BP_COND_TEST 10 // (operand & mask & value) != 0
+
+// flags of bp_cond_param
+#define RWMEM_BP_COND_ANY 0x1 // true if any term is true, default is all
+
+struct bp_cond_term {
+	uint32_t reg; // register id, or RWMEM_BP_REG_ADDR
+	uint8_t deref_size; // 0 for the register value, else 1/2/4/8 bytes at reg + offset
+	uint8_t op;
+	uint16_t reserved;
+	int64_t offset;
+	uint64_t mask;
+	uint64_t value;
+};
+
+struct bp_cond_param {
+	uint32_t count; // 0 removes the condition
+	uint32_t flags;
+	uint64_t terms; // user pointer to count struct bp_cond_term
+};
+
+struct rwmem_bp_cond {
+	struct rcu_head rcu;
+	uint32_t count;
+	uint32_t flags;
+	struct bp_cond_term terms[];
+};
+
+struct rwmem_bp_cond *rwmem_bp_cond_create(const struct bp_cond_param *param);
+bool rwmem_bp_cond_eval(const struct rwmem_bp_cond *cond,
+			struct pt_regs *regs, unsigned long addr);
+
+#endif
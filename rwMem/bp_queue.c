@@ -0,0 +1,253 @@
+#include "bp_queue.h"
+#include "api_proxy.h"
+#include "linux/anon_inodes.h"
+#include "linux/file.h"
+#include "linux/ktime.h"
+#include "linux/log2.h"
+#include "linux/overflow.h"
+#include "linux/poll.h"
+#include "linux/sched/signal.h"
+#include "linux/slab.h"
+#include "linux/spinlock.h"
+#include "linux/vmalloc.h"
+
+// events copied to userspace per round of read
+#define RWMEM_BP_QUEUE_READ_BATCH 32
+
+static const struct file_operations rwmem_bp_queue_fops;
+
+void rwmem_bp_queue_put(struct rwmem_bp_queue *queue)
+{
+	if (!refcount_dec_and_test(&queue->ref)) {
+		return;
+	}
+	vfree(queue->events);
+	kfree(queue);
+}
+
+static void rwmem_bp_queue_link_free_rcu(struct rcu_head *rcu)
+{
+	struct rwmem_bp_queue_link *link =
+		container_of(rcu, struct rwmem_bp_queue_link, rcu);
+
+	rwmem_bp_queue_put(link->queue);
+	kfree(link);
+}
+
+void rwmem_bp_queue_link_free(struct rwmem_bp_queue_link *link)
+{
+	if (link) {
+		call_rcu(&link->rcu, rwmem_bp_queue_link_free_rcu);
+	}
+}
+
+void rwmem_bp_queue_push(struct rwmem_bp_queue_link *link, uint32_t type,
+			 struct pt_regs *regs, unsigned long addr)
+{
+	struct rwmem_bp_queue *queue = link->queue;
+	struct rwmem_bp_event *event;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&queue->lock, flags);
+	if (queue->head - queue->tail >= queue->capacity) {
+		queue->lost++;
+		raw_spin_unlock_irqrestore(&queue->lock, flags);
+		return;
+	}
+	event = &queue->events[queue->head & (queue->capacity - 1)];
+	event->id = link->id;
+	event->time = ktime_get_ns();
+	event->tid = current->pid;
+	event->type = type;
+	event->pc = regs->pc;
+	event->addr = addr;
+	memcpy(event->regs, &regs->user_regs, sizeof(event->regs));
+	queue->head++;
+	raw_spin_unlock_irqrestore(&queue->lock, flags);
+
+	wake_up_all(&queue->wq);
+	kill_fasync(&queue->fasync, SIGIO, POLL_IN);
+}
+
+static bool rwmem_bp_queue_empty(struct rwmem_bp_queue *queue)
+{
+	return READ_ONCE(queue->head) == READ_ONCE(queue->tail);
+}
+
+// Move up to max events out of the queue, returns the number moved
+static uint32_t rwmem_bp_queue_pop(struct rwmem_bp_queue *queue,
+				   struct rwmem_bp_event *buf, uint32_t max)
+{
+	unsigned long flags;
+	uint32_t n = 0;
+
+	raw_spin_lock_irqsave(&queue->lock, flags);
+	while (n < max && queue->tail != queue->head) {
+		buf[n++] = queue->events[queue->tail & (queue->capacity - 1)];
+		queue->tail++;
+	}
+	raw_spin_unlock_irqrestore(&queue->lock, flags);
+	return n;
+}
+
+static ssize_t rwmem_bp_queue_read(struct file *filp, char __user *buf,
+				   size_t size, loff_t *ppos)
+{
+	struct rwmem_bp_queue *queue = filp->private_data;
+	size_t max = size / sizeof(struct rwmem_bp_event);
+	struct rwmem_bp_event *batch;
+	size_t copied = 0;
+	uint32_t n;
+	int ret;
+
+	if (!max) {
+		return -EINVAL;
+	}
+	if (rwmem_bp_queue_empty(queue)) {
+		if (filp->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		ret = wait_event_interruptible(queue->wq,
+					       !rwmem_bp_queue_empty(queue));
+		if (ret) {
+			return ret;
+		}
+	}
+
+	batch = kmalloc_array(min_t(size_t, max, RWMEM_BP_QUEUE_READ_BATCH),
+			      sizeof(*batch), GFP_KERNEL);
+	if (!batch) {
+		return -ENOMEM;
+	}
+	// events popped before a fault are lost, like a short read of a pipe
+	while (copied < max) {
+		n = rwmem_bp_queue_pop(
+			queue, batch,
+			min_t(size_t, max - copied, RWMEM_BP_QUEUE_READ_BATCH));
+		if (!n) {
+			break;
+		}
+		if (x_copy_to_user(buf + copied * sizeof(*batch), batch,
+				   n * sizeof(*batch))) {
+			kfree(batch);
+			return copied ? copied * sizeof(*batch) : -EFAULT;
+		}
+		copied += n;
+	}
+	kfree(batch);
+	return copied * sizeof(*batch);
+}
+
+static __poll_t rwmem_bp_queue_poll(struct file *filp, poll_table *wait)
+{
+	struct rwmem_bp_queue *queue = filp->private_data;
+
+	poll_wait(filp, &queue->wq, wait);
+	return rwmem_bp_queue_empty(queue) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static int rwmem_bp_queue_fasync(int fd, struct file *filp, int on)
+{
+	struct rwmem_bp_queue *queue = filp->private_data;
+	int retval;
+
+	retval = fasync_helper(fd, filp, on, &queue->fasync);
+	if (retval < 0) {
+		return retval;
+	}
+	return 0;
+}
+
+static long rwmem_bp_queue_ioctl(struct file *filp, unsigned int cmd,
+				 unsigned long arg)
+{
+	struct rwmem_bp_queue *queue = filp->private_data;
+
+	switch (cmd) {
+	case IOCTL_BP_QUEUE_GET_STATS: {
+		struct bp_queue_stats stats;
+		unsigned long flags;
+
+		raw_spin_lock_irqsave(&queue->lock, flags);
+		stats.capacity = queue->capacity;
+		stats.pending = queue->head - queue->tail;
+		stats.lost = queue->lost;
+		raw_spin_unlock_irqrestore(&queue->lock, flags);
+		if (x_copy_to_user((void *)arg, &stats, sizeof(stats))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
+static int rwmem_bp_queue_release(struct inode *inode, struct file *filp)
+{
+	struct rwmem_bp_queue *queue = filp->private_data;
+
+	// the attached bps keep the queue alive, they just fill it up
+	fasync_helper(-1, filp, 0, &queue->fasync);
+	rwmem_bp_queue_put(queue);
+	return 0;
+}
+
+static const struct file_operations rwmem_bp_queue_fops = {
+	.owner = THIS_MODULE,
+
+	.llseek = no_llseek,
+	.poll = rwmem_bp_queue_poll,
+	.read = rwmem_bp_queue_read,
+	.unlocked_ioctl = rwmem_bp_queue_ioctl,
+	.release = rwmem_bp_queue_release,
+	.fasync = rwmem_bp_queue_fasync,
+};
+
+struct file *rwmem_bp_queue_create(uint32_t capacity)
+{
+	struct rwmem_bp_queue *queue;
+	struct file *file;
+
+	if (!capacity || capacity > RWMEM_BP_QUEUE_MAX_EVENTS) {
+		return ERR_PTR(-EINVAL);
+	}
+	capacity = roundup_pow_of_two(capacity);
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+	if (!queue) {
+		return ERR_PTR(-ENOMEM);
+	}
+	queue->events = vmalloc(array_size(sizeof(*queue->events), capacity));
+	if (!queue->events) {
+		kfree(queue);
+		return ERR_PTR(-ENOMEM);
+	}
+	refcount_set(&queue->ref, 1);
+	raw_spin_lock_init(&queue->lock);
+	init_waitqueue_head(&queue->wq);
+	queue->capacity = capacity;
+	file = anon_inode_getfile("[bp_queue]", &rwmem_bp_queue_fops, queue,
+				  O_RDWR);
+	if (IS_ERR(file)) {
+		rwmem_bp_queue_put(queue);
+	}
+	return file;
+}
+
+struct rwmem_bp_queue *rwmem_bp_queue_get(int fd)
+{
+	struct rwmem_bp_queue *queue;
+	struct file *file = fget(fd);
+
+	if (!file) {
+		return ERR_PTR(-EBADF);
+	}
+	if (file->f_op != &rwmem_bp_queue_fops) {
+		fput(file);
+		return ERR_PTR(-EINVAL);
+	}
+	queue = file->private_data;
+	refcount_inc(&queue->ref);
+	fput(file);
+	return queue;
+}
@@ -0,0 +1,82 @@
+#ifndef _KERNEL_RWMEM_BP_QUEUE_H_
+#define _KERNEL_RWMEM_BP_QUEUE_H_
+
+#include "linux/fs.h"
+#include "linux/rcupdate.h"
+#include "linux/refcount.h"
+#include "linux/spinlock_types.h"
+#include "linux/types.h"
+#include "linux/wait.h"
+#include "asm/ptrace.h"
+
+#define RWMEM_BP_QUEUE_MAJOR_NUM 102
+#define RWMEM_BP_QUEUE_MAX_EVENTS 65536
+
+// type of rwmem_bp_event
+#define RWMEM_BP_EVENT_HIT 0 // a counted hit, in any mode
+#define RWMEM_BP_EVENT_STOP 1 // a thread stopped and waits for continue
+
+// flags of bp_queue_param, which events the bp reports
+#define RWMEM_BP_QUEUE_HITS 0x1
+#define RWMEM_BP_QUEUE_STOPS 0x2
+#define RWMEM_BP_QUEUE_ALL (RWMEM_BP_QUEUE_HITS | RWMEM_BP_QUEUE_STOPS)
+
+// One record of read() on a queue fd, read returns whole records only
+struct rwmem_bp_event {
+	uint64_t id; // chosen by userspace when attaching the bp
+	uint64_t time;
+	int32_t tid;
+	uint32_t type;
+	uint64_t pc;
+	uint64_t addr; // the accessed address, 0 for a stop
+	uint64_t regs[34]; // x0-x30, sp, pc and pstate
+};
+
+// attach a bp to the queue of fd, fd -1 detaches it
+struct bp_queue_param {
+	int32_t fd;
+	uint32_t flags;
+	uint64_t id;
+};
+
+struct bp_queue_stats {
+	uint32_t capacity;
+	uint32_t pending;
+	uint64_t lost; // events dropped because the queue was full
+};
+
+#define IOCTL_BP_QUEUE_GET_STATS                                               \
+	_IOR(RWMEM_BP_QUEUE_MAJOR_NUM, 0, struct bp_queue_stats)
+
+struct rwmem_bp_queue {
+	refcount_t ref;
+	raw_spinlock_t lock;
+	uint64_t head; // free running indexes into events
+	uint64_t tail;
+	uint64_t lost;
+	uint32_t capacity;
+	wait_queue_head_t wq;
+	struct fasync_struct *fasync;
+	struct rwmem_bp_event *events;
+};
+
+// The attachment of a bp to a queue, replaced as a whole under rcu
+struct rwmem_bp_queue_link {
+	struct rwmem_bp_queue *queue;
+	uint64_t id;
+	uint32_t flags;
+	struct rcu_head rcu;
+};
+
+// capacity is rounded up to a power of two
+struct file *rwmem_bp_queue_create(uint32_t capacity);
+// returns the queue of a queue fd with a reference held
+struct rwmem_bp_queue *rwmem_bp_queue_get(int fd);
+void rwmem_bp_queue_put(struct rwmem_bp_queue *queue);
+// frees the link and drops its queue reference after a grace period
+void rwmem_bp_queue_link_free(struct rwmem_bp_queue_link *link);
+// may be called from exception context
+void rwmem_bp_queue_push(struct rwmem_bp_queue_link *link, uint32_t type,
+			 struct pt_regs *regs, unsigned long addr);
+
+#endif
@@ -0,0 +1,118 @@
+#include "bp_ring.h"
+#include "linux/log2.h"
+#include "linux/mm.h"
+#include "linux/slab.h"
+#include "linux/spinlock.h"
+#include "linux/uaccess.h"
+#include "linux/vmalloc.h"
+
+struct rwmem_ring *rwmem_ring_alloc(uint32_t pages, uint32_t record_size)
+{
+	struct rwmem_ring *ring;
+
+	if (!pages || pages > RWMEM_RING_MAX_PAGES || !is_power_of_2(pages)) {
+		return ERR_PTR(-EINVAL);
+	}
+	if (!record_size || record_size > pages * PAGE_SIZE) {
+		return ERR_PTR(-EINVAL);
+	}
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring) {
+		return ERR_PTR(-ENOMEM);
+	}
+	ring->header = vmalloc_user((pages + 1) * PAGE_SIZE);
+	if (!ring->header) {
+		kfree(ring);
+		return ERR_PTR(-ENOMEM);
+	}
+	ring->data = (char *)ring->header + PAGE_SIZE;
+	ring->data_size = pages * PAGE_SIZE;
+	ring->record_size = record_size;
+	ring->header->data_size = ring->data_size;
+	ring->header->record_size = record_size;
+	raw_spin_lock_init(&ring->lock);
+	return ring;
+}
+
+void rwmem_ring_free(struct rwmem_ring *ring)
+{
+	if (!ring) {
+		return;
+	}
+	vfree(ring->header);
+	kfree(ring);
+}
+
+int rwmem_ring_mmap(struct rwmem_ring *ring, struct vm_area_struct *vma)
+{
+	// a private mapping would copy the header page on the first write of
+	// the tail, the kernel would never see the records consumed
+	if (!(vma->vm_flags & VM_SHARED)) {
+		return -EINVAL;
+	}
+	// only the tail may be written by userspace, but it lives in the
+	// header page, so the whole mapping is writable
+	return remap_vmalloc_range(vma, ring->header, 0);
+}
+
+bool rwmem_ring_begin(struct rwmem_ring *ring, uint64_t *pos,
+		      unsigned long *flags)
+{
+	uint64_t head, tail;
+
+	raw_spin_lock_irqsave(&ring->lock, *flags);
+	head = ring->header->head;
+	tail = smp_load_acquire(&ring->header->tail);
+	if (head - tail + ring->record_size > ring->data_size) {
+		ring->header->lost++;
+		raw_spin_unlock_irqrestore(&ring->lock, *flags);
+		return false;
+	}
+	*pos = head;
+	return true;
+}
+
+void rwmem_ring_put(struct rwmem_ring *ring, uint64_t *pos, const void *src,
+		    size_t len)
+{
+	uint32_t off = *pos & (ring->data_size - 1);
+	uint32_t first = min_t(size_t, len, ring->data_size - off);
+
+	memcpy(ring->data + off, src, first);
+	memcpy(ring->data, (const char *)src + first, len - first);
+	*pos += len;
+}
+
+size_t rwmem_ring_put_user(struct rwmem_ring *ring, uint64_t *pos,
+			   const void __user *src, size_t len)
+{
+	uint32_t off = *pos & (ring->data_size - 1);
+	uint32_t first = min_t(size_t, len, ring->data_size - off);
+	size_t copied = 0;
+
+	// unreadable bytes are left as zero
+	if (!copy_from_user_nofault(ring->data + off, src, first)) {
+		copied += first;
+	} else {
+		memset(ring->data + off, 0, first);
+	}
+	if (len > first) {
+		if (!copy_from_user_nofault(ring->data,
+					    (const char __user *)src + first,
+					    len - first)) {
+			copied += len - first;
+		} else {
+			memset(ring->data, 0, len - first);
+		}
+	}
+	*pos += len;
+	return copied;
+}
+
+void rwmem_ring_end(struct rwmem_ring *ring, unsigned long flags)
+{
+	smp_store_release(&ring->header->head,
+			  ring->header->head + ring->record_size);
+	raw_spin_unlock_irqrestore(&ring->lock, flags);
+}
@@ -0,0 +1,50 @@
+#ifndef _KERNEL_RWMEM_BP_RING_H_
+#define _KERNEL_RWMEM_BP_RING_H_
+
+#include "linux/fs.h"
+#include "linux/mm_types.h"
+#include "linux/spinlock_types.h"
+#include "linux/types.h"
+
+#define RWMEM_RING_MAX_PAGES 1024
+
+// The first page of the mapping, the data pages follow it.
+// head and tail are free running byte counters, a record starts at
+// (tail % data_size) and may wrap around the end of the data area.
+struct rwmem_ring_header {
+	uint64_t head; // written by the kernel
+	uint64_t tail; // written by userspace
+	uint64_t lost; // records dropped because the ring was full
+	uint32_t record_size;
+	uint32_t data_size;
+};
+
+struct rwmem_ring {
+	struct rwmem_ring_header *header;
+	char *data;
+	uint32_t data_size;
+	uint32_t record_size;
+	raw_spinlock_t lock;
+};
+
+struct rwmem_ring *rwmem_ring_alloc(uint32_t pages, uint32_t record_size);
+void rwmem_ring_free(struct rwmem_ring *ring);
+int rwmem_ring_mmap(struct rwmem_ring *ring, struct vm_area_struct *vma);
+
+// Producer side, may be called from exception context.
+// rwmem_ring_begin returns false (and counts a lost record) when the ring
+// is full, otherwise the ring stays locked until rwmem_ring_end.
+bool rwmem_ring_begin(struct rwmem_ring *ring, uint64_t *pos,
+		      unsigned long *flags);
+void rwmem_ring_put(struct rwmem_ring *ring, uint64_t *pos, const void *src,
+		    size_t len);
+size_t rwmem_ring_put_user(struct rwmem_ring *ring, uint64_t *pos,
+			   const void __user *src, size_t len);
+void rwmem_ring_end(struct rwmem_ring *ring, unsigned long flags);
+
+static inline bool rwmem_ring_empty(struct rwmem_ring *ring)
+{
+	return READ_ONCE(ring->header->head) == READ_ONCE(ring->header->tail);
+}
+
+#endif
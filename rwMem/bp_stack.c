@@ -0,0 +1,146 @@
+#include "bp_stack.h"
+#include "asm/pointer_auth.h"
+#include "linux/jhash.h"
+#include "linux/log2.h"
+#include "linux/slab.h"
+#include "linux/spinlock.h"
+#include "linux/uaccess.h"
+#include "linux/version.h"
+
+struct rwmem_bp_stacks *rwmem_bp_stacks_alloc(struct bp_stack_param *param)
+{
+	struct rwmem_bp_stacks *stacks;
+	uint32_t capacity = param->capacity;
+
+	if (!capacity || capacity > RWMEM_BP_STACK_MAX_ENTRIES ||
+	    !param->depth || param->depth > RWMEM_BP_STACK_MAX_DEPTH) {
+		return ERR_PTR(-EINVAL);
+	}
+	stacks = kzalloc(sizeof(*stacks), GFP_KERNEL);
+	if (!stacks) {
+		return ERR_PTR(-ENOMEM);
+	}
+	if (rwmem_bp_table_init(&stacks->table, roundup_pow_of_two(capacity),
+				sizeof(struct rwmem_bp_stack_entry))) {
+		kfree(stacks);
+		return ERR_PTR(-ENOMEM);
+	}
+	stacks->depth = param->depth;
+	return stacks;
+}
+
+void rwmem_bp_stacks_free(struct rwmem_bp_stacks *stacks)
+{
+	rwmem_bp_table_destroy(&stacks->table);
+	kfree(stacks);
+}
+
+static unsigned long strip_pac(unsigned long lr)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	return ptrauth_strip_user_insn_pac(lr);
+#else
+	return ptrauth_strip_insn_pac(lr);
+#endif
+}
+
+// Walk the frame records of the current thread like the perf user
+// callchain does. Page faults are disabled, a frame which is not present
+// ends the walk.
+static uint32_t stack_walk(struct pt_regs *regs, uint64_t *frames,
+			   uint32_t depth)
+{
+	unsigned long lr = strip_pac(regs->regs[30]);
+	unsigned long fp = regs->regs[29];
+	unsigned long record[2]; // the caller's fp and the return address
+	uint32_t n = 0;
+
+	frames[n++] = regs->pc;
+	if (compat_user_mode(regs)) {
+		return n;
+	}
+	while (n < depth && fp && !(fp & 0xf)) {
+		if (copy_from_user_nofault(record, (void __user *)fp,
+					   sizeof(record))) {
+			break;
+		}
+		if (!record[1]) {
+			break;
+		}
+		record[1] = strip_pac(record[1]);
+		// a hit in a leaf function, or in the prologue before the frame
+		// record is pushed, has its caller only in the link register
+		if (n == 1 && lr && lr != record[1]) {
+			frames[n++] = lr;
+			if (n == depth) {
+				break;
+			}
+		}
+		frames[n++] = record[1];
+		// the stack grows down, a record below this one is garbage
+		if (record[0] <= fp) {
+			break;
+		}
+		fp = record[0];
+	}
+	// without any frame record the caller is only in the link register
+	if (n == 1 && lr && n < depth) {
+		frames[n++] = lr;
+	}
+	return n;
+}
+
+void rwmem_bp_stacks_add(struct rwmem_bp_stacks *stacks, struct pt_regs *regs,
+			 unsigned long addr)
+{
+	uint32_t mask = (1U << stacks->table.bits) - 1;
+	uint64_t frames[RWMEM_BP_STACK_MAX_DEPTH];
+	struct rwmem_bp_stack_entry *entry;
+	unsigned long flags;
+	uint32_t depth, i, n;
+
+	// the walk reads user memory, it is done before taking the lock
+	depth = stack_walk(regs, frames, stacks->depth);
+	i = jhash2((u32 *)frames, depth * 2, depth) & mask;
+
+	raw_spin_lock_irqsave(&stacks->table.lock, flags);
+	for (n = 0; n <= mask; n++, i = (i + 1) & mask) {
+		entry = (struct rwmem_bp_stack_entry *)stacks->table.rows + i;
+		if (entry->depth == depth &&
+		    !memcmp(entry->frames, frames, depth * sizeof(*frames))) {
+			break;
+		}
+		if (!entry->depth) {
+			entry->depth = depth;
+			memcpy(entry->frames, frames, depth * sizeof(*frames));
+			entry->first_addr = addr;
+			stacks->table.count++;
+			break;
+		}
+	}
+	if (n > mask) {
+		stacks->table.dropped++;
+		raw_spin_unlock_irqrestore(&stacks->table.lock, flags);
+		return;
+	}
+	entry->hits++;
+	entry->last_tid = current->pid;
+	raw_spin_unlock_irqrestore(&stacks->table.lock, flags);
+}
+
+static bool stack_row_used(const void *row)
+{
+	const struct rwmem_bp_stack_entry *entry = row;
+
+	return entry->depth;
+}
+
+// Copy the used slots to userspace, returns the number of entries copied
+long rwmem_bp_stacks_read(struct rwmem_bp_stacks *stacks,
+			  struct bp_stack_read_param *param)
+{
+	return rwmem_bp_table_read(&stacks->table, stack_row_used,
+				   param->entries, param->max_entries,
+				   param->flags & RWMEM_BP_STACK_RESET,
+				   &param->dropped);
+}
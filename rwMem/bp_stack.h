@@ -0,0 +1,56 @@
+#ifndef _KERNEL_RWMEM_BP_STACK_H_
+#define _KERNEL_RWMEM_BP_STACK_H_
+
+#include "bp_aggr.h"
+#include "linux/spinlock_types.h"
+#include "linux/types.h"
+#include "asm/ptrace.h"
+
+#define RWMEM_BP_STACK_MAX_ENTRIES 4096
+#define RWMEM_BP_STACK_MAX_DEPTH 32
+
+// flags of bp_stack_read_param
+// like RWMEM_BP_AGGR_RESET
+#define RWMEM_BP_STACK_RESET 0x1
+
+struct bp_stack_param {
+	uint32_t capacity; // unique stacks
+	uint32_t depth; // frames per stack, the pc included
+};
+
+// One row per unique call stack which hit the bp. frames[0] is the pc,
+// then the link register (x30) unless the first frame record returns to
+// it, then the return addresses found by following the frame pointers
+// (x29) of the thread.
+struct rwmem_bp_stack_entry {
+	uint64_t hits;
+	uint32_t depth; // frames used, 0 marks a free slot in the kernel
+	int32_t last_tid;
+	uint64_t first_addr; // the accessed address of the first hit
+	uint64_t frames[RWMEM_BP_STACK_MAX_DEPTH];
+};
+
+struct bp_stack_read_param {
+	uint64_t entries; // user pointer to max_entries entries
+	uint32_t max_entries;
+	uint32_t flags;
+	uint64_t dropped; // out: hits of stacks which did not fit
+};
+
+// An open addressing hash table keyed by the whole stack, like the table of
+// rwmem_bp_aggr
+struct rwmem_bp_stacks {
+	struct rwmem_bp_table table; // of struct rwmem_bp_stack_entry
+	uint32_t depth;
+};
+
+// capacity is rounded up to a power of two
+struct rwmem_bp_stacks *rwmem_bp_stacks_alloc(struct bp_stack_param *param);
+void rwmem_bp_stacks_free(struct rwmem_bp_stacks *stacks);
+// may be called from exception context
+void rwmem_bp_stacks_add(struct rwmem_bp_stacks *stacks, struct pt_regs *regs,
+			 unsigned long addr);
+long rwmem_bp_stacks_read(struct rwmem_bp_stacks *stacks,
+			  struct bp_stack_read_param *param);
+
+#endif
@@ -0,0 +1,179 @@
+#include "freeze.h"
+#include "api_proxy.h"
+#include "linux/anon_inodes.h"
+#include "linux/file.h"
+#include "linux/jiffies.h"
+#include "linux/overflow.h"
+#include "linux/rcupdate.h"
+#include "linux/sched/signal.h"
+#include "linux/slab.h"
+
+static void rwmem_freeze_put(struct rwmem_freeze *freeze)
+{
+	if (!refcount_dec_and_test(&freeze->ref)) {
+		return;
+	}
+	kfree(freeze);
+}
+
+static void rwmem_freeze_thaw(struct rwmem_freeze *freeze)
+{
+	WRITE_ONCE(freeze->thawed, true);
+	wake_up_all(&freeze->wq);
+}
+
+// The task work of a thread, it parks the thread until the thaw like
+// bp_callback_after stops it until continue
+static void freeze_park(struct callback_head *twork)
+{
+	struct freeze_cb *cb = container_of(twork, struct freeze_cb, twork);
+	struct rwmem_freeze *freeze = cb->freeze;
+	long timeout;
+
+	// task works also run at exit, an exiting thread does not park
+	if (current->flags & PF_EXITING) {
+		atomic_inc(&freeze->exited);
+		wake_up_all(&freeze->wq);
+		rwmem_freeze_put(freeze);
+		return;
+	}
+
+	atomic_inc(&freeze->parked);
+	wake_up_all(&freeze->wq);
+	// the deadline is shared, so all threads thaw together on timeout
+	timeout = (long)(freeze->deadline - jiffies);
+	if (!READ_ONCE(freeze->thawed) &&
+	    (timeout <= 0 ||
+	     !wait_event_killable_timeout(freeze->wq, READ_ONCE(freeze->thawed),
+					  timeout))) {
+		WRITE_ONCE(freeze->timed_out, true);
+	}
+	atomic_dec(&freeze->parked);
+	rwmem_freeze_put(freeze);
+}
+
+static bool rwmem_freeze_done(struct rwmem_freeze *freeze)
+{
+	return atomic_read(&freeze->parked) + atomic_read(&freeze->exited) >=
+	       freeze->threads;
+}
+
+static long rwmem_freeze_ioctl(struct file *filp, unsigned int cmd,
+			       unsigned long arg)
+{
+	struct rwmem_freeze *freeze = filp->private_data;
+
+	switch (cmd) {
+	case IOCTL_FREEZE_WAIT: {
+		long ret = wait_event_interruptible_timeout(
+			freeze->wq,
+			rwmem_freeze_done(freeze) || READ_ONCE(freeze->thawed),
+			msecs_to_jiffies(arg));
+		if (ret < 0) {
+			return ret;
+		}
+		if (READ_ONCE(freeze->thawed)) {
+			return -ECANCELED;
+		}
+		return rwmem_freeze_done(freeze) ? 0 : -ETIMEDOUT;
+	}
+	case IOCTL_FREEZE_GET_STATE: {
+		struct freeze_state state = {
+			.threads = freeze->threads,
+			.parked = atomic_read(&freeze->parked),
+			.exited = atomic_read(&freeze->exited),
+			.timed_out = READ_ONCE(freeze->timed_out),
+		};
+		if (x_copy_to_user((void *)arg, &state, sizeof(state))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+	case IOCTL_FREEZE_THAW: {
+		rwmem_freeze_thaw(freeze);
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
+static int rwmem_freeze_release(struct inode *inode, struct file *filp)
+{
+	struct rwmem_freeze *freeze = filp->private_data;
+
+	rwmem_freeze_thaw(freeze);
+	rwmem_freeze_put(freeze);
+	return 0;
+}
+
+static const struct file_operations rwmem_freeze_fops = {
+	.owner = THIS_MODULE,
+
+	.llseek = no_llseek,
+	.unlocked_ioctl = rwmem_freeze_ioctl,
+	.release = rwmem_freeze_release,
+};
+
+struct file *rwmem_freeze_create(struct task_struct *leader,
+				 struct freeze_param *param)
+{
+	int notify = param->flags & RWMEM_FREEZE_INTERRUPT ? TWA_SIGNAL :
+							     TWA_RESUME;
+	uint32_t timeout_ms = param->timeout_ms;
+	struct rwmem_freeze *freeze;
+	struct freeze_cb *cb;
+	struct task_struct *t;
+	struct file *file;
+	unsigned int max_threads, n = 0;
+
+	if (param->flags & ~RWMEM_FREEZE_INTERRUPT) {
+		return ERR_PTR(-EINVAL);
+	}
+	if (!leader->mm || leader->flags & PF_KTHREAD) {
+		return ERR_PTR(-EINVAL);
+	}
+	if (!timeout_ms || timeout_ms > RWMEM_FREEZE_MAX_TIMEOUT_MS) {
+		timeout_ms = RWMEM_FREEZE_MAX_TIMEOUT_MS;
+	}
+
+	// threads cloned after this are not frozen
+	max_threads = get_nr_threads(leader);
+	freeze = kzalloc(struct_size(freeze, cbs, max_threads), GFP_KERNEL);
+	if (!freeze) {
+		return ERR_PTR(-ENOMEM);
+	}
+	refcount_set(&freeze->ref, 1);
+	init_waitqueue_head(&freeze->wq);
+	freeze->deadline = jiffies + msecs_to_jiffies(timeout_ms);
+	file = anon_inode_getfile("[rwmem_freeze]", &rwmem_freeze_fops, freeze,
+				  O_RDWR);
+	if (IS_ERR(file)) {
+		kfree(freeze);
+		return file;
+	}
+
+	rcu_read_lock();
+	for_each_thread (leader, t) {
+		if (n == max_threads) {
+			break;
+		}
+		// the caller would park itself
+		if (t == current) {
+			continue;
+		}
+		cb = &freeze->cbs[n++];
+		cb->freeze = freeze;
+		init_task_work(&cb->twork, freeze_park);
+		refcount_inc(&freeze->ref);
+		// the thread is exiting, the file still holds a reference
+		if (task_work_add(t, &cb->twork, notify)) {
+			refcount_dec(&freeze->ref);
+			atomic_inc(&freeze->exited);
+		}
+	}
+	// a waiter can only start once the file is installed
+	freeze->threads = n;
+	rcu_read_unlock();
+	return file;
+}
@@ -0,0 +1,67 @@
+#ifndef _KERNEL_RWMEM_FREEZE_H_
+#define _KERNEL_RWMEM_FREEZE_H_
+
+#include "linux/fs.h"
+#include "linux/refcount.h"
+#include "linux/sched.h"
+#include "linux/task_work.h"
+#include "linux/types.h"
+#include "linux/wait.h"
+
+#define RWMEM_FREEZE_MAJOR_NUM 103
+// the longest a thread stays frozen, also used for a timeout of 0
+#define RWMEM_FREEZE_MAX_TIMEOUT_MS 60000
+
+// flags of freeze_param
+// interrupt threads sleeping in a syscall, like a signal does, so they park
+// too instead of when the syscall returns
+#define RWMEM_FREEZE_INTERRUPT 0x1
+
+// Park every thread of pid's thread group at its next return to user mode.
+// The threads resume together on IOCTL_FREEZE_THAW or when the freeze fd is
+// closed, and by themselves once timeout_ms has passed.
+struct freeze_param {
+	int32_t pid;
+	uint32_t timeout_ms;
+	uint32_t flags;
+};
+
+struct freeze_state {
+	uint32_t threads; // threads asked to park
+	uint32_t parked; // threads parked now
+	uint32_t exited; // threads which exited before they parked
+	uint32_t timed_out; // the timeout has thawed the threads
+};
+
+// wait for every thread to park, arg is the timeout in ms, returns
+// -ETIMEDOUT if some threads are still running then
+#define IOCTL_FREEZE_WAIT _IO(RWMEM_FREEZE_MAJOR_NUM, 0)
+#define IOCTL_FREEZE_GET_STATE                                                 \
+	_IOR(RWMEM_FREEZE_MAJOR_NUM, 1, struct freeze_state)
+#define IOCTL_FREEZE_THAW _IO(RWMEM_FREEZE_MAJOR_NUM, 2)
+
+struct rwmem_freeze;
+
+// The parking task of one thread, like hit_bp_cb of a bp
+struct freeze_cb {
+	struct callback_head twork;
+	struct rwmem_freeze *freeze;
+};
+
+struct rwmem_freeze {
+	refcount_t ref; // the file and every pending park hold a reference
+	bool thawed;
+	bool timed_out;
+	unsigned long deadline; // in jiffies
+	uint32_t threads;
+	atomic_t parked;
+	atomic_t exited;
+	wait_queue_head_t wq;
+	struct freeze_cb cbs[];
+};
+
+// park the threads of leader's thread group, returns the file of the freeze
+struct file *rwmem_freeze_create(struct task_struct *leader,
+				 struct freeze_param *param);
+
+#endif
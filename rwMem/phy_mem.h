@@ -5,6 +5,8 @@
 #include "api_proxy.h"
 #include "asm-generic/bitops/const_hweight.h"
 #include "linux/mm.h"
+#include "rwmem_trace.h"
+#include "stats.h"
 #include "ver_control.h"
 #include <asm/page.h>
 #include <linux/fs.h>
@@ -60,6 +62,7 @@ static inline size_t get_task_proc_phy_addr(struct task_struct *task,
 	unsigned long paddr = 0;
 	unsigned long page_addr = 0;
 	unsigned long page_offset = 0;
+	u64 start = rwmem_stat_begin();
 	//////////////////////////////////////////////////////////////////////////
 	*(size_t *)out_pte = 0;
 
@@ -84,6 +87,7 @@ static inline size_t get_task_proc_phy_addr(struct task_struct *task,
 	printk_debug("pgd_index = %d\n", pgd_index(virt_addr));
 	if (pgd_none(*pgd)) {
 		printk_debug("not mapped in pgd\n");
+		trace_rwmem_page_walk_fail(task->pid, virt_addr, RWMEM_WALK_PGD);
 		goto out;
 	}
 	printk_debug("pgd_offset ok\n");
@@ -97,6 +101,7 @@ static inline size_t get_task_proc_phy_addr(struct task_struct *task,
 	printk_debug("p4d_val = 0x%lx\n", p4d_val(*p4d));
 	if (p4d_none(*p4d)) {
 		printk_debug("not mapped in p4d\n");
+		trace_rwmem_page_walk_fail(task->pid, virt_addr, RWMEM_WALK_P4D);
 		goto out;
 	}
 
@@ -104,6 +109,7 @@ static inline size_t get_task_proc_phy_addr(struct task_struct *task,
 	printk_debug("pud_val = 0x%llx \n", pud_val(*pud));
 	if (pud_none(*pud)) {
 		printk_debug("not mapped in pud\n");
+		trace_rwmem_page_walk_fail(task->pid, virt_addr, RWMEM_WALK_PUD);
 		goto out;
 	}
 	printk_debug("pud_offset ok\n");
@@ -113,6 +119,7 @@ static inline size_t get_task_proc_phy_addr(struct task_struct *task,
 	// printk_debug("pmd_index = %d\n", pmd_index(virt_addr));
 	if (pmd_none(*pmd)) {
 		printk_debug("not mapped in pmd\n");
+		trace_rwmem_page_walk_fail(task->pid, virt_addr, RWMEM_WALK_PMD);
 		goto out;
 	}
 	printk_debug("pmd_offset ok\n");
@@ -122,6 +129,7 @@ static inline size_t get_task_proc_phy_addr(struct task_struct *task,
 	// printk_debug("pte_index = %d\n", pte_index(virt_addr));
 	if (pte_none(*pte)) {
 		printk_debug("not mapped in pte\n");
+		trace_rwmem_page_walk_fail(task->pid, virt_addr, RWMEM_WALK_PTE);
 		goto out;
 	}
 	printk_debug("pte_offset_kernel ok\n");
@@ -139,6 +147,10 @@ static inline size_t get_task_proc_phy_addr(struct task_struct *task,
 
 out:
 	mmput(mm);
+	if (!paddr) {
+		rwmem_stat_not_present(RWMEM_STAT_PAGE_WALK);
+	}
+	rwmem_stat_end(RWMEM_STAT_PAGE_WALK, start, paddr ? 0 : -EFAULT, 0);
 	return paddr;
 }
 
@@ -244,15 +256,18 @@ static inline size_t read_ram_physical_addr(size_t phy_addr, char *lpBuf,
 {
 	void *bounce;
 	size_t realRead = 0;
+	u64 start = rwmem_stat_begin();
 	if (!check_phys_addr_valid_range(phy_addr, read_size)) {
 		printk_debug(
 			KERN_INFO
 			"Error in check_phys_addr_valid_range:%p,size:%zu\n",
 			phy_addr, read_size);
+		rwmem_stat_end(RWMEM_STAT_PHY_READ, start, -EINVAL, 0);
 		return 0;
 	}
 	bounce = kmalloc(PAGE_SIZE, GFP_KERNEL);
 	if (!bounce) {
+		rwmem_stat_end(RWMEM_STAT_PHY_READ, start, -ENOMEM, 0);
 		return 0;
 	}
 
@@ -296,6 +311,8 @@ static inline size_t read_ram_physical_addr(size_t phy_addr, char *lpBuf,
 		realRead += sz;
 	}
 	kfree(bounce);
+	rwmem_stat_end(RWMEM_STAT_PHY_READ, start,
+		       read_size ? -EFAULT : 0, realRead);
 	return realRead;
 }
 
@@ -304,11 +321,13 @@ static inline size_t write_ram_physical_addr(size_t phy_addr, char *lpBuf,
 					     size_t write_size)
 {
 	size_t realWrite = 0;
+	u64 start = rwmem_stat_begin();
 	if (!check_phys_addr_valid_range(phy_addr, write_size)) {
 		printk_debug(
 			KERN_INFO
 			"Error in check_phys_addr_valid_range:0x%llx,size:%zu\n",
 			phy_addr, write_size);
+		rwmem_stat_end(RWMEM_STAT_PHY_WRITE, start, -EINVAL, 0);
 		return 0;
 	}
 
@@ -347,6 +366,8 @@ static inline size_t write_ram_physical_addr(size_t phy_addr, char *lpBuf,
 		write_size -= sz;
 		realWrite += sz;
 	}
+	rwmem_stat_end(RWMEM_STAT_PHY_WRITE, start,
+		       write_size ? -EFAULT : 0, realWrite);
 	return realWrite;
 }
 
@@ -0,0 +1,141 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rwmem
+
+#if !defined(_KERNEL_RWMEM_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _KERNEL_RWMEM_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+#define RWMEM_WALK_PGD 0
+#define RWMEM_WALK_P4D 1
+#define RWMEM_WALK_PUD 2
+#define RWMEM_WALK_PMD 3
+#define RWMEM_WALK_PTE 4
+
+DECLARE_EVENT_CLASS(rwmem_rw,
+	TP_PROTO(pid_t pid, size_t addr, size_t size, bool force),
+	TP_ARGS(pid, addr, size, force),
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(size_t, addr)
+		__field(size_t, size)
+		__field(bool, force)
+	),
+	TP_fast_assign(
+		__entry->pid = pid;
+		__entry->addr = addr;
+		__entry->size = size;
+		__entry->force = force;
+	),
+	TP_printk("pid=%d addr=0x%zx size=%zu force=%d", __entry->pid,
+		  __entry->addr, __entry->size, __entry->force)
+);
+
+DEFINE_EVENT(rwmem_rw, rwmem_read,
+	TP_PROTO(pid_t pid, size_t addr, size_t size, bool force),
+	TP_ARGS(pid, addr, size, force)
+);
+
+DEFINE_EVENT(rwmem_rw, rwmem_write,
+	TP_PROTO(pid_t pid, size_t addr, size_t size, bool force),
+	TP_ARGS(pid, addr, size, force)
+);
+
+DECLARE_EVENT_CLASS(rwmem_rw_done,
+	TP_PROTO(ssize_t ret),
+	TP_ARGS(ret),
+	TP_STRUCT__entry(
+		__field(ssize_t, ret)
+	),
+	TP_fast_assign(
+		__entry->ret = ret;
+	),
+	TP_printk("ret=%zd", __entry->ret)
+);
+
+DEFINE_EVENT(rwmem_rw_done, rwmem_read_done,
+	TP_PROTO(ssize_t ret),
+	TP_ARGS(ret)
+);
+
+DEFINE_EVENT(rwmem_rw_done, rwmem_write_done,
+	TP_PROTO(ssize_t ret),
+	TP_ARGS(ret)
+);
+
+TRACE_EVENT(rwmem_page_walk_fail,
+	TP_PROTO(pid_t pid, size_t addr, int level),
+	TP_ARGS(pid, addr, level),
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(size_t, addr)
+		__field(int, level)
+	),
+	TP_fast_assign(
+		__entry->pid = pid;
+		__entry->addr = addr;
+		__entry->level = level;
+	),
+	TP_printk("pid=%d addr=0x%zx not mapped in %s", __entry->pid,
+		  __entry->addr,
+		  __print_symbolic(__entry->level,
+				   { RWMEM_WALK_PGD, "pgd" },
+				   { RWMEM_WALK_P4D, "p4d" },
+				   { RWMEM_WALK_PUD, "pud" },
+				   { RWMEM_WALK_PMD, "pmd" },
+				   { RWMEM_WALK_PTE, "pte" }))
+);
+
+TRACE_EVENT(rwmem_bp_hit,
+	TP_PROTO(pid_t pid, unsigned long pc, unsigned long addr),
+	TP_ARGS(pid, pc, addr),
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(unsigned long, pc)
+		__field(unsigned long, addr)
+	),
+	TP_fast_assign(
+		__entry->pid = pid;
+		__entry->pc = pc;
+		__entry->addr = addr;
+	),
+	TP_printk("pid=%d pc=0x%lx addr=0x%lx", __entry->pid, __entry->pc,
+		  __entry->addr)
+);
+
+DECLARE_EVENT_CLASS(rwmem_bp_state,
+	TP_PROTO(pid_t pid, unsigned long pc),
+	TP_ARGS(pid, pc),
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(unsigned long, pc)
+	),
+	TP_fast_assign(
+		__entry->pid = pid;
+		__entry->pc = pc;
+	),
+	TP_printk("pid=%d pc=0x%lx", __entry->pid, __entry->pc)
+);
+
+DEFINE_EVENT(rwmem_bp_state, rwmem_bp_stop,
+	TP_PROTO(pid_t pid, unsigned long pc),
+	TP_ARGS(pid, pc)
+);
+
+DEFINE_EVENT(rwmem_bp_state, rwmem_bp_continue,
+	TP_PROTO(pid_t pid, unsigned long pc),
+	TP_ARGS(pid, pc)
+);
+
+DEFINE_EVENT(rwmem_bp_state, rwmem_bp_step,
+	TP_PROTO(pid_t pid, unsigned long pc),
+	TP_ARGS(pid, pc)
+);
+
+#endif /* _KERNEL_RWMEM_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE rwmem_trace
+#include <trace/define_trace.h>
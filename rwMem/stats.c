@@ -0,0 +1,151 @@
+#include "stats.h"
+#include "linux/debugfs.h"
+#include "linux/fs.h"
+#include "linux/log2.h"
+#include "linux/module.h"
+#include "linux/percpu.h"
+#include "linux/seq_file.h"
+#include "linux/string.h"
+
+#ifdef CONFIG_RWMEM_STATS
+
+struct rwmem_stat {
+	u64 calls;
+	u64 failures;
+	u64 bytes;
+	u64 not_present;
+	u64 hist[RWMEM_STAT_HIST_BUCKETS];
+};
+
+struct rwmem_stats {
+	struct rwmem_stat stat[RWMEM_STAT_NR];
+};
+
+static DEFINE_PER_CPU(struct rwmem_stats, rwmem_stats);
+static struct dentry *rwmem_debugfs_dir;
+
+void rwmem_stat_end(int id, u64 start, long ret, size_t bytes)
+{
+	struct rwmem_stats *stats;
+	struct rwmem_stat *stat;
+	u64 delta = ktime_get_ns() - start;
+	unsigned int bucket = delta ? ilog2(delta) : 0;
+
+	if (id < 0 || id >= RWMEM_STAT_NR) {
+		return;
+	}
+	if (bucket >= RWMEM_STAT_HIST_BUCKETS) {
+		bucket = RWMEM_STAT_HIST_BUCKETS - 1;
+	}
+
+	stats = get_cpu_ptr(&rwmem_stats);
+	stat = &stats->stat[id];
+	stat->calls++;
+	if (ret < 0) {
+		stat->failures++;
+	}
+	stat->bytes += bytes;
+	stat->hist[bucket]++;
+	put_cpu_ptr(&rwmem_stats);
+}
+
+void rwmem_stat_not_present(int id)
+{
+	struct rwmem_stats *stats;
+
+	if (id < 0 || id >= RWMEM_STAT_NR) {
+		return;
+	}
+	stats = get_cpu_ptr(&rwmem_stats);
+	stats->stat[id].not_present++;
+	put_cpu_ptr(&rwmem_stats);
+}
+
+static void rwmem_stat_sum(int id, struct rwmem_stat *sum)
+{
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu (cpu) {
+		struct rwmem_stat *stat = &per_cpu(rwmem_stats, cpu).stat[id];
+		sum->calls += READ_ONCE(stat->calls);
+		sum->failures += READ_ONCE(stat->failures);
+		sum->bytes += READ_ONCE(stat->bytes);
+		sum->not_present += READ_ONCE(stat->not_present);
+		for (i = 0; i < RWMEM_STAT_HIST_BUCKETS; i++) {
+			sum->hist[i] += READ_ONCE(stat->hist[i]);
+		}
+	}
+}
+
+static int rwmem_stats_show(struct seq_file *m, void *v)
+{
+	struct rwmem_stat sum;
+	int id, i;
+
+	for (id = 0; id < RWMEM_STAT_NR; id++) {
+		rwmem_stat_sum(id, &sum);
+		if (!sum.calls && !sum.not_present) {
+			continue;
+		}
+		if (rwmem_stat_names[id]) {
+			seq_printf(m, "%s:", rwmem_stat_names[id]);
+		} else if (id >= RWMEM_STAT_BP_IOCTL) {
+			seq_printf(m, "bp_ioctl_%d:", id - RWMEM_STAT_BP_IOCTL);
+		} else {
+			seq_printf(m, "ioctl_%d:", id - RWMEM_STAT_IOCTL);
+		}
+		seq_printf(m,
+			   " calls=%llu failures=%llu bytes=%llu not_present=%llu\n",
+			   sum.calls, sum.failures, sum.bytes, sum.not_present);
+		// log2 latency histogram, bucket i counts [2^i, 2^(i+1)) ns
+		for (i = 0; i < RWMEM_STAT_HIST_BUCKETS; i++) {
+			if (sum.hist[i]) {
+				seq_printf(m, "\t%12lluns: %llu\n", 1ULL << i,
+					   sum.hist[i]);
+			}
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rwmem_stats);
+
+static ssize_t rwmem_stats_reset_write(struct file *filp,
+				       const char __user *buf, size_t size,
+				       loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu (cpu) {
+		memset(per_cpu_ptr(&rwmem_stats, cpu), 0,
+		       sizeof(struct rwmem_stats));
+	}
+	return size;
+}
+
+static const struct file_operations rwmem_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = rwmem_stats_reset_write,
+	.llseek = no_llseek,
+};
+
+// The statistics are a debugging aid, the driver works without them, so a
+// debugfs failure is not an error
+void rwmem_stats_init(void)
+{
+	rwmem_debugfs_dir = debugfs_create_dir(DEV_FILENAME, NULL);
+	if (IS_ERR(rwmem_debugfs_dir)) {
+		return;
+	}
+	debugfs_create_file("stats", 0400, rwmem_debugfs_dir, NULL,
+			    &rwmem_stats_fops);
+	debugfs_create_file("reset", 0200, rwmem_debugfs_dir, NULL,
+			    &rwmem_stats_reset_fops);
+}
+
+void rwmem_stats_exit(void)
+{
+	debugfs_remove_recursive(rwmem_debugfs_dir);
+	rwmem_debugfs_dir = NULL;
+}
+#endif
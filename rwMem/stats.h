@@ -0,0 +1,58 @@
+#ifndef _KERNEL_RWMEM_STATS_H_
+#define _KERNEL_RWMEM_STATS_H_
+
+#include "linux/ioctl.h"
+#include "linux/ktime.h"
+#include "linux/types.h"
+#include "ver_control.h"
+
+#define RWMEM_STAT_MAX_IOCTL 32
+#define RWMEM_STAT_HIST_BUCKETS 32
+
+enum rwmem_stat_id {
+	RWMEM_STAT_READ,
+	RWMEM_STAT_WRITE,
+	RWMEM_STAT_PAGE_WALK,
+	RWMEM_STAT_PHY_READ,
+	RWMEM_STAT_PHY_WRITE,
+	RWMEM_STAT_BP_HIT,
+	RWMEM_STAT_BP_STEP,
+	// one slot per _IOC_NR of the device and bp ioctls
+	RWMEM_STAT_IOCTL,
+	RWMEM_STAT_BP_IOCTL = RWMEM_STAT_IOCTL + RWMEM_STAT_MAX_IOCTL,
+	RWMEM_STAT_NR = RWMEM_STAT_BP_IOCTL + RWMEM_STAT_MAX_IOCTL,
+};
+
+#ifdef CONFIG_RWMEM_STATS
+extern const char *const rwmem_stat_names[RWMEM_STAT_NR];
+
+void rwmem_stats_init(void);
+void rwmem_stats_exit(void);
+void rwmem_stat_end(int id, u64 start, long ret, size_t bytes);
+void rwmem_stat_not_present(int id);
+
+static inline u64 rwmem_stat_begin(void)
+{
+	return ktime_get_ns();
+}
+#else
+static inline void rwmem_stats_init(void) {}
+static inline void rwmem_stats_exit(void) {}
+static inline void rwmem_stat_end(int id, u64 start, long ret, size_t bytes) {}
+static inline void rwmem_stat_not_present(int id) {}
+static inline u64 rwmem_stat_begin(void)
+{
+	return 0;
+}
+#endif
+
+// Map an ioctl command to its stat slot, or -1 if it is not one of ours
+static inline int rwmem_stat_ioctl_id(int base, unsigned int cmd)
+{
+	if (_IOC_NR(cmd) >= RWMEM_STAT_MAX_IOCTL) {
+		return -1;
+	}
+	return base + _IOC_NR(cmd);
+}
+
+#endif
@@ -0,0 +1,822 @@
+#include "swbp.h"
+#include "bp.h"
+#include "asm/cacheflush.h"
+#include "asm/cachetype.h"
+#include "asm/insn.h"
+#include "linux/bitmap.h"
+#include "linux/hash.h"
+#include "linux/hashtable.h"
+#include "linux/list.h"
+#include "linux/mm.h"
+#include "linux/mutex.h"
+#include "linux/sched/mm.h"
+#include "linux/sched/signal.h"
+#include "linux/slab.h"
+#include "linux/spinlock.h"
+#include "linux/task_work.h"
+#include "linux/uaccess.h"
+#include "proc_maps.h"
+
+#define RWMEM_SWBP_HASH_BITS 10
+// most threads which can be between a hit and its task work
+#define RWMEM_SWBP_STEP_POOL_SIZE 256
+
+// The out of line area of an mm, like the xol area of uprobes: one mapping
+// of the target with a slot per breakpoint whose instruction is not
+// emulated. A slot holds the original instruction and a BRK which moves the
+// thread back behind the breakpoint.
+#define RWMEM_SWBP_XOL_SLOT_SIZE (2 * AARCH64_INSN_SIZE)
+#define RWMEM_SWBP_XOL_SLOTS 4096
+#define RWMEM_SWBP_XOL_SIZE                                                    \
+	PAGE_ALIGN(RWMEM_SWBP_XOL_SLOTS * RWMEM_SWBP_XOL_SLOT_SIZE)
+#define RWMEM_SWBP_XOL_PAGES (RWMEM_SWBP_XOL_SIZE >> PAGE_SHIFT)
+
+struct swbp_xol_slot {
+	unsigned long addr; // of the breakpoint, the thread returns behind it
+	unsigned int users; // threads sent to the slot which did not return
+	bool removed; // the breakpoint is gone, the slot is free once unused
+};
+
+struct swbp_xol_area {
+	struct list_head list;
+	struct mm_struct *mm; // grabbed
+	unsigned long vaddr; // 0 until a thread of mm maps it
+	unsigned int nr_bps; // breakpoints with a slot
+	unsigned int nr_users; // threads in any slot
+	bool release_queued;
+	struct callback_head twork; // releases the area from a thread of mm
+	struct page *pages[RWMEM_SWBP_XOL_PAGES];
+	DECLARE_BITMAP(used, RWMEM_SWBP_XOL_SLOTS);
+	struct swbp_xol_slot slots[RWMEM_SWBP_XOL_SLOTS];
+};
+
+struct rwmem_swbp {
+	struct hlist_node node;
+	struct mm_struct *mm; // grabbed
+	struct rwmem_bp_private_data *data;
+	unsigned long addr;
+	uint32_t orig_insn;
+	bool emulate; // the instruction depends on its address
+	bool enabled;
+	bool inserted; // the BRK is in the text now
+	struct swbp_xol_area *area; // NULL if the instruction is emulated
+	unsigned int slot;
+};
+
+// A thread which hit the BRK. The task work runs after the stop of the hit,
+// it emulates the instruction or sends the thread to its slot. Task works
+// also run when the thread exits, so an entry never outlives its thread.
+struct swbp_step_entry {
+	struct list_head list;
+	struct callback_head twork;
+	struct rwmem_swbp *bp; // NULL once the breakpoint is removed
+	unsigned long addr; // of the BRK
+};
+
+// protects the table, the step list, the step pool, the out of line areas
+// and the flags of every breakpoint
+static DEFINE_SPINLOCK(swbp_lock);
+static DEFINE_HASHTABLE(swbp_table, RWMEM_SWBP_HASH_BITS);
+static LIST_HEAD(swbp_step_list);
+static LIST_HEAD(swbp_xol_list);
+// the BRK hook never allocates, the entries come from this pool
+static struct swbp_step_entry swbp_step_pool[RWMEM_SWBP_STEP_POOL_SIZE];
+static DECLARE_BITMAP(swbp_step_pool_used, RWMEM_SWBP_STEP_POOL_SIZE);
+// serializes the writes to the text and the out of line areas of the
+// breakpoints, taken before the mmap lock and swbp_lock
+static DEFINE_MUTEX(swbp_text_mutex);
+
+// Take an entry of the step pool, with swbp_lock held
+static struct swbp_step_entry *swbp_step_entry_alloc(void)
+{
+	unsigned int i = find_first_zero_bit(swbp_step_pool_used,
+					     RWMEM_SWBP_STEP_POOL_SIZE);
+
+	if (i == RWMEM_SWBP_STEP_POOL_SIZE) {
+		return NULL;
+	}
+	__set_bit(i, swbp_step_pool_used);
+	memset(&swbp_step_pool[i], 0, sizeof(swbp_step_pool[i]));
+	return &swbp_step_pool[i];
+}
+
+// Return an entry to the step pool, with swbp_lock held
+static void swbp_step_entry_free(struct swbp_step_entry *entry)
+{
+	list_del(&entry->list);
+	__clear_bit(entry - swbp_step_pool, swbp_step_pool_used);
+}
+
+// The area of mm, with swbp_lock held
+static struct swbp_xol_area *swbp_xol_find(struct mm_struct *mm)
+{
+	struct swbp_xol_area *area;
+
+	list_for_each_entry (area, &swbp_xol_list, list) {
+		if (area->mm == mm) {
+			return area;
+		}
+	}
+	return NULL;
+}
+
+// The pages are looked up through the mm, so a mapping left behind never
+// points to a freed area
+static vm_fault_t swbp_xol_fault(const struct vm_special_mapping *sm,
+				 struct vm_area_struct *vma,
+				 struct vm_fault *vmf)
+{
+	struct swbp_xol_area *area;
+	vm_fault_t ret = VM_FAULT_SIGBUS;
+
+	spin_lock(&swbp_lock);
+	area = swbp_xol_find(vma->vm_mm);
+	if (area && vmf->pgoff < RWMEM_SWBP_XOL_PAGES) {
+		vmf->page = area->pages[vmf->pgoff];
+		get_page(vmf->page);
+		ret = 0;
+	}
+	spin_unlock(&swbp_lock);
+	return ret;
+}
+
+// threads in a slot return to the address the area was mapped at
+static int swbp_xol_mremap(const struct vm_special_mapping *sm,
+			   struct vm_area_struct *new_vma)
+{
+	return -EINVAL;
+}
+
+static const struct vm_special_mapping swbp_xol_mapping = {
+	.name = "[rwmem_xol]",
+	.fault = swbp_xol_fault,
+	.mremap = swbp_xol_mremap,
+};
+
+// Unmap the area from the target if it is still there, and free it
+static void swbp_xol_free(struct swbp_xol_area *area)
+{
+	struct mm_struct *mm = area->mm;
+	struct vm_area_struct *vma;
+	unsigned long addr = 0;
+	unsigned int i;
+
+	if (area->vaddr && mmget_not_zero(mm)) {
+		down_write(&mm->MM_STRUCT_MMAP_LOCK);
+		// it can not be moved, but an mprotect may have split it
+		while ((vma = find_vma(mm, addr))) {
+			addr = vma->vm_end;
+			if (vma->vm_private_data == &swbp_xol_mapping) {
+				do_munmap(mm, vma->vm_start,
+					  addr - vma->vm_start, NULL);
+			}
+		}
+		up_write(&mm->MM_STRUCT_MMAP_LOCK);
+		mmput(mm);
+	}
+	for (i = 0; i < RWMEM_SWBP_XOL_PAGES; i++) {
+		if (area->pages[i]) {
+			put_page(area->pages[i]);
+		}
+	}
+	mmdrop(mm);
+	kvfree(area);
+}
+
+// Get the area of mm for a new breakpoint, with the text mutex held
+static struct swbp_xol_area *swbp_xol_get(struct mm_struct *mm)
+{
+	struct swbp_xol_area *area;
+	unsigned int i;
+
+	spin_lock(&swbp_lock);
+	area = swbp_xol_find(mm);
+	if (area) {
+		area->nr_bps++;
+	}
+	spin_unlock(&swbp_lock);
+	if (area) {
+		return area;
+	}
+
+	area = kvzalloc(sizeof(*area), GFP_KERNEL);
+	if (!area) {
+		return NULL;
+	}
+	for (i = 0; i < RWMEM_SWBP_XOL_PAGES; i++) {
+		area->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (!area->pages[i]) {
+			while (i--) {
+				put_page(area->pages[i]);
+			}
+			kvfree(area);
+			return NULL;
+		}
+	}
+	mmgrab(mm);
+	area->mm = mm;
+	area->nr_bps = 1;
+	spin_lock(&swbp_lock);
+	list_add(&area->list, &swbp_xol_list);
+	spin_unlock(&swbp_lock);
+	return area;
+}
+
+// Drop the area of a removed breakpoint, with the text mutex held. Threads
+// still in a slot release it when the last one returns, unless the mm is
+// gone and they never will.
+static void swbp_xol_put(struct swbp_xol_area *area)
+{
+	bool release;
+
+	spin_lock(&swbp_lock);
+	release = !--area->nr_bps && !area->release_queued &&
+		  (!area->nr_users || !atomic_read(&area->mm->mm_users));
+	if (release) {
+		list_del(&area->list);
+	}
+	spin_unlock(&swbp_lock);
+	if (release) {
+		swbp_xol_free(area);
+	}
+}
+
+static void swbp_xol_release(struct callback_head *twork)
+{
+	struct swbp_xol_area *area =
+		container_of(twork, struct swbp_xol_area, twork);
+	bool release;
+
+	mutex_lock(&swbp_text_mutex);
+	spin_lock(&swbp_lock);
+	area->release_queued = false;
+	// a new breakpoint of the mm may use it again
+	release = !area->nr_bps && !area->nr_users;
+	if (release) {
+		list_del(&area->list);
+	}
+	spin_unlock(&swbp_lock);
+	if (release) {
+		swbp_xol_free(area);
+	}
+	mutex_unlock(&swbp_text_mutex);
+}
+
+// Give bp a slot holding its instruction, with the text mutex held. A slot
+// is only reused once no thread is in it, so it is written in place.
+static int swbp_xol_attach(struct rwmem_swbp *bp)
+{
+	struct swbp_xol_area *area = swbp_xol_get(bp->mm);
+	unsigned long off, start;
+	uint32_t *insn;
+	unsigned int i;
+
+	if (!area) {
+		return -ENOMEM;
+	}
+	spin_lock(&swbp_lock);
+	i = find_first_zero_bit(area->used, RWMEM_SWBP_XOL_SLOTS);
+	if (i < RWMEM_SWBP_XOL_SLOTS) {
+		__set_bit(i, area->used);
+		area->slots[i].addr = bp->addr;
+		area->slots[i].users = 0;
+		area->slots[i].removed = false;
+	}
+	spin_unlock(&swbp_lock);
+	if (i == RWMEM_SWBP_XOL_SLOTS) {
+		swbp_xol_put(area);
+		return -ENOSPC;
+	}
+
+	off = (unsigned long)i * RWMEM_SWBP_XOL_SLOT_SIZE;
+	insn = page_address(area->pages[off >> PAGE_SHIFT]) + (off & ~PAGE_MASK);
+	insn[0] = bp->orig_insn;
+	insn[1] = RWMEM_SWBP_XOL_INSN;
+	start = (unsigned long)insn;
+	flush_icache_range(start, start + RWMEM_SWBP_XOL_SLOT_SIZE);
+	// the thread runs the slot through its own mapping of the page
+	if (icache_is_aliasing()) {
+		__flush_icache_all();
+	}
+	bp->area = area;
+	bp->slot = i;
+	return 0;
+}
+
+static void swbp_xol_detach(struct rwmem_swbp *bp)
+{
+	struct swbp_xol_slot *slot = &bp->area->slots[bp->slot];
+
+	spin_lock(&swbp_lock);
+	slot->removed = true;
+	if (!slot->users) {
+		__clear_bit(bp->slot, bp->area->used);
+	}
+	spin_unlock(&swbp_lock);
+	swbp_xol_put(bp->area);
+}
+
+// Map the area in the target, from a thread of it with the text mutex held
+static unsigned long swbp_xol_map(struct swbp_xol_area *area)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned long vaddr;
+
+	if (area->vaddr || mm != area->mm) {
+		return area->vaddr;
+	}
+	down_write(&mm->MM_STRUCT_MMAP_LOCK);
+	vaddr = get_unmapped_area(NULL, 0, RWMEM_SWBP_XOL_SIZE, 0, 0);
+	if (IS_ERR_VALUE(vaddr)) {
+		vaddr = 0;
+	} else {
+		vma = _install_special_mapping(
+			mm, vaddr, RWMEM_SWBP_XOL_SIZE,
+			VM_EXEC | VM_MAYEXEC | VM_DONTCOPY | VM_IO,
+			&swbp_xol_mapping);
+		if (IS_ERR(vma)) {
+			vaddr = 0;
+		}
+	}
+	up_write(&mm->MM_STRUCT_MMAP_LOCK);
+	if (vaddr) {
+		spin_lock(&swbp_lock);
+		area->vaddr = vaddr;
+		spin_unlock(&swbp_lock);
+	}
+	return vaddr;
+}
+
+// Move a thread which ran the instruction of a slot behind its breakpoint,
+// from the BRK of the slot or from a step. Returns false if the pc is not
+// behind the instruction of a slot.
+static bool swbp_xol_return(struct pt_regs *regs)
+{
+	struct swbp_xol_area *area;
+	struct swbp_xol_slot *slot;
+	unsigned long off;
+	unsigned int i;
+	bool ret = false;
+
+	spin_lock(&swbp_lock);
+	area = swbp_xol_find(current->mm);
+	if (!area || !area->vaddr || regs->pc < area->vaddr) {
+		goto out;
+	}
+	off = regs->pc - area->vaddr;
+	if (off >= RWMEM_SWBP_XOL_SIZE ||
+	    off % RWMEM_SWBP_XOL_SLOT_SIZE != AARCH64_INSN_SIZE) {
+		goto out;
+	}
+	i = off / RWMEM_SWBP_XOL_SLOT_SIZE;
+	if (!test_bit(i, area->used)) {
+		goto out;
+	}
+	slot = &area->slots[i];
+	regs->pc = slot->addr + AARCH64_INSN_SIZE;
+	ret = true;
+	// a thread which left the slot another way (a longjmp out of a signal
+	// handler) keeps it in use, and the area with it until the last
+	// breakpoint of the mm is removed after the mm exited
+	if (!slot->users) {
+		goto out;
+	}
+	slot->users--;
+	area->nr_users--;
+	if (slot->removed && !slot->users) {
+		__clear_bit(i, area->used);
+	}
+	// the last breakpoint of the mm went away while threads were in it.
+	// The area is unmapped from this thread, if it is not exiting.
+	if (!area->nr_bps && !area->nr_users && !area->release_queued) {
+		init_task_work(&area->twork, swbp_xol_release);
+		if (!task_work_add(current, &area->twork, TWA_RESUME)) {
+			area->release_queued = true;
+		}
+	}
+out:
+	spin_unlock(&swbp_lock);
+	return ret;
+}
+
+static u32 swbp_hash(struct mm_struct *mm, unsigned long addr)
+{
+	return hash_long((unsigned long)mm ^ addr, RWMEM_SWBP_HASH_BITS);
+}
+
+static struct rwmem_swbp *swbp_find(struct mm_struct *mm, unsigned long addr)
+{
+	struct rwmem_swbp *bp;
+
+	hlist_for_each_entry (bp, &swbp_table[swbp_hash(mm, addr)], node) {
+		if (bp->mm == mm && bp->addr == addr) {
+			return bp;
+		}
+	}
+	return NULL;
+}
+
+// Write one instruction like ptrace does: a private mapping gets its own
+// copy of the page, and the icache is synchronized for executable pages
+static int swbp_write(struct mm_struct *mm, unsigned long addr, uint32_t insn)
+{
+	if (access_remote_vm(mm, addr, &insn, sizeof(insn),
+			     FOLL_FORCE | FOLL_WRITE) != sizeof(insn)) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+// Insert or remove the BRK as the flags of bp say, with the text mutex held
+static void swbp_sync(struct rwmem_swbp *bp)
+{
+	bool insert = bp->enabled;
+
+	if (bp->inserted == insert || !mmget_not_zero(bp->mm)) {
+		return;
+	}
+	if (!swbp_write(bp->mm, bp->addr,
+			insert ? RWMEM_SWBP_INSN : bp->orig_insn)) {
+		spin_lock(&swbp_lock);
+		bp->inserted = insert;
+		spin_unlock(&swbp_lock);
+	}
+	mmput(bp->mm);
+}
+
+// Instructions which depend on their address are emulated, the others run
+// in a slot of the out of line area. Returns false for the ones which can do neither.
+static bool swbp_insn_supported(uint32_t insn, bool *emulate)
+{
+	*emulate = aarch64_insn_is_b(insn) || aarch64_insn_is_bl(insn) ||
+		   aarch64_insn_is_bcond(insn) || aarch64_insn_is_cbz(insn) ||
+		   aarch64_insn_is_cbnz(insn) || aarch64_insn_is_tbz(insn) ||
+		   aarch64_insn_is_tbnz(insn) || aarch64_insn_is_br(insn) ||
+		   aarch64_insn_is_blr(insn) || aarch64_insn_is_ret(insn) ||
+		   aarch64_insn_is_adr(insn) || aarch64_insn_is_adrp(insn) ||
+		   aarch64_insn_is_ldr_lit(insn) ||
+		   aarch64_insn_is_ldrsw_lit(insn) ||
+		   aarch64_insn_is_prfm_lit(insn);
+	if (*emulate) {
+		return true;
+	}
+	// the authenticated branches, the SIMD literal loads, the exceptions
+	// and the exclusives (the step clears the monitor) are left
+	return !aarch64_insn_is_branch(insn) &&
+	       !aarch64_insn_uses_literal(insn) &&
+	       !aarch64_insn_is_exception(insn) &&
+	       !aarch64_insn_is_load_ex(insn) && !aarch64_insn_is_store_ex(insn);
+}
+
+static bool swbp_cond_holds(uint32_t cond, u64 pstate)
+{
+	bool n = pstate & PSR_N_BIT, z = pstate & PSR_Z_BIT;
+	bool c = pstate & PSR_C_BIT, v = pstate & PSR_V_BIT;
+	bool ret;
+
+	switch (cond >> 1) {
+	case 0:
+		ret = z;
+		break;
+	case 1:
+		ret = c;
+		break;
+	case 2:
+		ret = n;
+		break;
+	case 3:
+		ret = v;
+		break;
+	case 4:
+		ret = c && !z;
+		break;
+	case 5:
+		ret = n == v;
+		break;
+	case 6:
+		ret = !z && n == v;
+		break;
+	default:
+		return true;
+	}
+	return (cond & 1) ? !ret : ret;
+}
+
+// register 31 is the zero register for these instructions
+static u64 swbp_reg(struct pt_regs *regs, int n)
+{
+	return n == 31 ? 0 : regs->regs[n];
+}
+
+static void swbp_set_reg(struct pt_regs *regs, int n, u64 val)
+{
+	if (n != 31) {
+		regs->regs[n] = val;
+	}
+}
+
+// Run an instruction of the BRK at addr which depends on its address, like
+// the simulation of kprobes does, in the thread which hit it
+static void swbp_emulate(uint32_t insn, unsigned long addr,
+			 struct pt_regs *regs)
+{
+	unsigned long next = addr + AARCH64_INSN_SIZE;
+	bool taken = false;
+	int rt = insn & 0x1f;
+	u64 val;
+
+	if (aarch64_insn_is_b(insn) || aarch64_insn_is_bl(insn)) {
+		if (aarch64_insn_is_bl(insn)) {
+			regs->regs[30] = next;
+		}
+		taken = true;
+	} else if (aarch64_insn_is_bcond(insn)) {
+		taken = swbp_cond_holds(insn & 0xf, regs->pstate);
+	} else if (aarch64_insn_is_cbz(insn) || aarch64_insn_is_cbnz(insn)) {
+		val = swbp_reg(regs, rt);
+		if (!(insn & BIT(31))) {
+			val = (u32)val;
+		}
+		taken = !val == aarch64_insn_is_cbz(insn);
+	} else if (aarch64_insn_is_tbz(insn) || aarch64_insn_is_tbnz(insn)) {
+		val = swbp_reg(regs, rt) &
+		      BIT_ULL(((insn >> 26) & 0x20) | ((insn >> 19) & 0x1f));
+		taken = !val == aarch64_insn_is_tbz(insn);
+	} else if (aarch64_insn_is_br(insn) || aarch64_insn_is_blr(insn) ||
+		   aarch64_insn_is_ret(insn)) {
+		next = swbp_reg(regs, (insn >> 5) & 0x1f);
+		if (aarch64_insn_is_blr(insn)) {
+			regs->regs[30] = addr + AARCH64_INSN_SIZE;
+		}
+	} else if (aarch64_insn_is_adr(insn) || aarch64_insn_is_adrp(insn)) {
+		val = sign_extend64(((insn >> 3) & 0x1ffffc) |
+					    ((insn >> 29) & 0x3),
+				    20);
+		if (aarch64_insn_is_adrp(insn)) {
+			val = (addr & ~0xfffUL) + (val << 12);
+		} else {
+			val += addr;
+		}
+		swbp_set_reg(regs, rt, val);
+	} else if (aarch64_insn_is_ldr_lit(insn) ||
+		   aarch64_insn_is_ldrsw_lit(insn)) {
+		unsigned long lit =
+			addr + (sign_extend64((insn >> 5) & 0x7ffff, 18) << 2);
+		int ret;
+
+		if (aarch64_insn_is_ldrsw_lit(insn)) {
+			s32 word;
+			ret = get_user(word, (s32 __user *)lit);
+			val = (s64)word;
+		} else if (insn & BIT(30)) {
+			ret = get_user(val, (u64 __user *)lit);
+		} else {
+			u32 word;
+			ret = get_user(word, (u32 __user *)lit);
+			val = word;
+		}
+		// like the load would, the pc stays at the BRK
+		if (ret) {
+			force_sig_fault(SIGSEGV, SEGV_MAPERR, (void __user *)lit);
+			return;
+		}
+		swbp_set_reg(regs, rt, val);
+	}
+	// a prefetch does nothing
+	if (taken) {
+		next = addr + aarch64_get_branch_offset(insn);
+	}
+	regs->pc = next;
+}
+
+// The task work of a hit, it runs after the stop of the hit and sees the
+// registers the user left
+static void swbp_step_begin(struct callback_head *twork)
+{
+	struct swbp_step_entry *entry =
+		container_of(twork, struct swbp_step_entry, twork);
+	struct pt_regs *regs = task_pt_regs(current);
+	struct swbp_xol_area *area = NULL;
+	struct rwmem_swbp *bp;
+	unsigned int slot = 0;
+	bool emulate = false;
+	uint32_t insn = 0;
+
+	mutex_lock(&swbp_text_mutex);
+	spin_lock(&swbp_lock);
+	bp = entry->bp;
+	spin_unlock(&swbp_lock);
+	// a removed bp has put the instruction back, and a stop or an action
+	// which moved the pc skips it. An exiting thread runs nothing.
+	if (current->mm && bp && regs->pc == entry->addr) {
+		emulate = bp->emulate;
+		insn = bp->orig_insn;
+		if (!emulate && swbp_xol_map(bp->area)) {
+			area = bp->area;
+			slot = bp->slot;
+		}
+	}
+	mutex_unlock(&swbp_text_mutex);
+	if (emulate) {
+		// a step asked for in the stop ends after the next instruction
+		swbp_emulate(insn, entry->addr, regs);
+	}
+
+	spin_lock(&swbp_lock);
+	// without the area the thread hits the BRK again. A bp removed since
+	// the mutex was dropped leaves its slot until the thread returns.
+	if (area) {
+		area->slots[slot].users++;
+		area->nr_users++;
+		regs->pc = area->vaddr + slot * RWMEM_SWBP_XOL_SLOT_SIZE;
+	}
+	swbp_step_entry_free(entry);
+	spin_unlock(&swbp_lock);
+}
+
+int rwmem_swbp_install(struct file *file, unsigned long addr, bool disabled)
+{
+	struct rwmem_bp_private_data *data = file->private_data;
+	struct mm_struct *mm;
+	struct rwmem_swbp *bp;
+	uint32_t insn;
+	int ret = 0;
+
+	if (addr & (AARCH64_INSN_SIZE - 1)) {
+		return -EINVAL;
+	}
+	mm = get_task_mm(data->target_task);
+	if (!mm) {
+		return -ESRCH;
+	}
+	bp = kzalloc(sizeof(*bp), GFP_KERNEL);
+	if (!bp) {
+		mmput(mm);
+		return -ENOMEM;
+	}
+	mmgrab(mm);
+	bp->mm = mm;
+	bp->data = data;
+	bp->addr = addr;
+	bp->enabled = !disabled;
+
+	mutex_lock(&swbp_text_mutex);
+	if (access_remote_vm(mm, addr, &insn, sizeof(insn), FOLL_FORCE) !=
+	    sizeof(insn)) {
+		ret = -EFAULT;
+		goto out;
+	}
+	bp->orig_insn = insn;
+	// one breakpoint per address, and none on a BRK we left behind
+	spin_lock(&swbp_lock);
+	if (swbp_find(mm, addr) || insn == RWMEM_SWBP_INSN) {
+		ret = -EBUSY;
+	} else if (!swbp_insn_supported(insn, &bp->emulate)) {
+		ret = -EINVAL;
+	}
+	spin_unlock(&swbp_lock);
+	if (!ret && !bp->emulate) {
+		ret = swbp_xol_attach(bp);
+	}
+	if (ret) {
+		goto out;
+	}
+	spin_lock(&swbp_lock);
+	hash_add(swbp_table, &bp->node, swbp_hash(mm, addr));
+	data->swbp = bp;
+	spin_unlock(&swbp_lock);
+	if (bp->enabled) {
+		swbp_sync(bp);
+		if (!bp->inserted) {
+			// undone by the release of the file
+			ret = -EFAULT;
+		}
+	}
+out:
+	mutex_unlock(&swbp_text_mutex);
+	mmput(mm);
+	if (ret && data->swbp != bp) {
+		mmdrop(mm);
+		kfree(bp);
+	}
+	return ret;
+}
+
+void rwmem_swbp_enable(struct rwmem_swbp *bp)
+{
+	mutex_lock(&swbp_text_mutex);
+	spin_lock(&swbp_lock);
+	bp->enabled = true;
+	spin_unlock(&swbp_lock);
+	swbp_sync(bp);
+	mutex_unlock(&swbp_text_mutex);
+}
+
+void rwmem_swbp_disable(struct rwmem_swbp *bp)
+{
+	mutex_lock(&swbp_text_mutex);
+	spin_lock(&swbp_lock);
+	bp->enabled = false;
+	spin_unlock(&swbp_lock);
+	swbp_sync(bp);
+	mutex_unlock(&swbp_text_mutex);
+}
+
+void rwmem_swbp_remove(struct rwmem_swbp *bp)
+{
+	struct swbp_step_entry *entry;
+
+	mutex_lock(&swbp_text_mutex);
+	spin_lock(&swbp_lock);
+	hash_del(&bp->node);
+	bp->enabled = false;
+	// threads in the slot return through it, the others run the original
+	// instruction which is put back now
+	list_for_each_entry (entry, &swbp_step_list, list) {
+		if (entry->bp == bp) {
+			entry->bp = NULL;
+		}
+	}
+	spin_unlock(&swbp_lock);
+	swbp_sync(bp);
+	if (bp->area) {
+		swbp_xol_detach(bp);
+	}
+	mutex_unlock(&swbp_text_mutex);
+	mmdrop(bp->mm);
+	kfree(bp);
+}
+
+// Called from the single step hook. A step of the instruction in a slot
+// ends on its BRK, the thread continues behind the breakpoint instead. The
+// step is not consumed, it is reported like a step of the original.
+void rwmem_swbp_step(struct pt_regs *regs)
+{
+	if (!list_empty(&swbp_xol_list)) {
+		swbp_xol_return(regs);
+	}
+}
+
+// The hook of the BRK which ends every slot
+int rwmem_swbp_xol_brk_handler(struct pt_regs *regs, unsigned long esr)
+{
+	return swbp_xol_return(regs) ? DBG_HOOK_HANDLED : DBG_HOOK_ERROR;
+}
+
+// The BRK hook, called in exception context. The BRK stays in the text,
+// other threads keep hitting it while this one runs the instruction.
+int rwmem_swbp_brk_handler(struct pt_regs *regs, unsigned long esr)
+{
+	struct rwmem_bp_private_data *data = NULL;
+	struct swbp_step_entry *entry = NULL;
+	struct mm_struct *mm = current->mm;
+	unsigned long addr = regs->pc;
+	struct rwmem_swbp *bp;
+	uint32_t insn;
+
+	spin_lock(&swbp_lock);
+	bp = swbp_find(mm, addr);
+	// the BRK is being written, or removed while this thread trapped on
+	// it, the thread runs the address again
+	if (bp && bp->inserted) {
+		// with the pool empty the thread hits the BRK again
+		entry = swbp_step_entry_alloc();
+	}
+	if (entry) {
+		entry->bp = bp;
+		entry->addr = addr;
+		list_add(&entry->list, &swbp_step_list);
+		data = bp->data;
+		refcount_inc(&data->ref);
+	}
+	spin_unlock(&swbp_lock);
+
+	if (!bp) {
+		// the instruction is back, unless the BRK is not ours
+		if (copy_from_user_nofault(&insn, (void __user *)addr,
+					   sizeof(insn)) ||
+		    insn != RWMEM_SWBP_INSN) {
+			return DBG_HOOK_HANDLED;
+		}
+		return DBG_HOOK_ERROR;
+	}
+	if (!entry) {
+		return DBG_HOOK_HANDLED;
+	}
+
+	// Task works run last in first out: queued before rwmem_bp_hit queues
+	// the stop, it runs after the stop and sees the registers the user
+	// left. Queued after it, the stop would show the pc in the slot.
+	init_task_work(&entry->twork, swbp_step_begin);
+	if (task_work_add(current, &entry->twork, TWA_RESUME)) {
+		// the thread is exiting
+		spin_lock(&swbp_lock);
+		swbp_step_entry_free(entry);
+		spin_unlock(&swbp_lock);
+	} else {
+		rwmem_bp_hit(data, regs, addr);
+	}
+	rwmem_bp_put(data);
+	return DBG_HOOK_HANDLED;
+}
@@ -0,0 +1,33 @@
+#ifndef _KERNEL_RWMEM_SWBP_H_
+#define _KERNEL_RWMEM_SWBP_H_
+
+#include "linux/fs.h"
+#include "linux/types.h"
+#include "asm/debug-monitors.h"
+#include "asm/ptrace.h"
+
+// Software breakpoints replace the instruction at the address with a BRK in
+// the private (copy on write) text of the target. The BRK stays there while
+// threads hit it: an instruction which depends on its address is emulated,
+// any other runs in a slot of one area mapped in the target per mm, which
+// ends with a BRK moving the thread back behind the breakpoint. Hits are
+// reported like hits of a hardware breakpoint.
+
+// the immediate of our BRK, the kernel uses 0x004-0x005 and 0x100-0x900
+#define RWMEM_SWBP_BRK_IMM 0x5cb
+#define RWMEM_SWBP_INSN (AARCH64_BREAK_MON | (RWMEM_SWBP_BRK_IMM << 5))
+// the immediate of the BRK behind the instruction in a slot
+#define RWMEM_SWBP_XOL_BRK_IMM 0x5cc
+#define RWMEM_SWBP_XOL_INSN (AARCH64_BREAK_MON | (RWMEM_SWBP_XOL_BRK_IMM << 5))
+
+struct rwmem_swbp;
+
+int rwmem_swbp_install(struct file *file, unsigned long addr, bool disabled);
+void rwmem_swbp_enable(struct rwmem_swbp *bp);
+void rwmem_swbp_disable(struct rwmem_swbp *bp);
+void rwmem_swbp_remove(struct rwmem_swbp *bp);
+void rwmem_swbp_step(struct pt_regs *regs);
+int rwmem_swbp_brk_handler(struct pt_regs *regs, unsigned long esr);
+int rwmem_swbp_xol_brk_handler(struct pt_regs *regs, unsigned long esr);
+
+#endif
@@ -0,0 +1,593 @@
+#include "swwp.h"
+#include "asm/esr.h"
+#include "asm/pgtable.h"
+#include "asm/tlb.h"
+#include "asm/tlbflush.h"
+#include "bp.h"
+#include "linux/atomic.h"
+#include "linux/bitmap.h"
+#include "linux/hugetlb.h"
+#include "linux/hw_breakpoint.h"
+#include "linux/list.h"
+#include "linux/mm.h"
+#include "linux/page-flags.h"
+#include "linux/sched/mm.h"
+#include "linux/slab.h"
+#include "linux/spinlock.h"
+#include "linux/task_work.h"
+#include "linux/version.h"
+#include "proc_maps.h"
+#include "ver_control.h"
+
+struct swwp_page {
+	pte_t orig; // the pte before it was protected, for its permissions
+	pte_t armed_pte; // the protected pte we installed
+	bool armed;
+};
+
+struct rwmem_swwp {
+	struct list_head list;
+	struct mm_struct *mm; // grabbed
+	struct rwmem_bp_private_data *data;
+	unsigned long start; // the watched range is [start, end)
+	unsigned long end;
+	unsigned long first_page;
+	uint8_t type;
+	bool enabled;
+	unsigned int nr_pages;
+	struct swwp_page pages[];
+};
+
+// A thread which steps over an access to a watched page. The page is
+// protected again by the task work once the access is done.
+struct swwp_step_entry {
+	struct list_head list;
+	struct callback_head twork;
+	pid_t pid;
+	struct rwmem_swwp *wp; // NULL once the watchpoint is removed
+	unsigned long addr; // the page
+	bool was_stepping; // the thread was single stepping already
+	bool queued; // the task work is queued
+};
+
+// most threads which can step over a watched access at the same time
+#define RWMEM_SWWP_STEP_POOL_SIZE 256
+
+// protects both lists, the step pool and the page state of every
+// watchpoint. Taken after the mmap lock of the target (the fault hook does
+// not hold it) and before its pte locks.
+static DEFINE_SPINLOCK(swwp_lock);
+static LIST_HEAD(swwp_list);
+static LIST_HEAD(swwp_step_list);
+// the fault hook never allocates, the entries come from this pool
+static struct swwp_step_entry swwp_step_pool[RWMEM_SWWP_STEP_POOL_SIZE];
+static DECLARE_BITMAP(swwp_step_pool_used, RWMEM_SWWP_STEP_POOL_SIZE);
+// lets the fault hook return early when no watchpoint exists
+static atomic_t swwp_count = ATOMIC_INIT(0);
+
+static struct swwp_page *swwp_page(struct rwmem_swwp *wp, unsigned long addr)
+{
+	return &wp->pages[(addr - wp->first_page) >> PAGE_SHIFT];
+}
+
+static bool swwp_covers(struct rwmem_swwp *wp, unsigned long addr)
+{
+	unsigned long size = (unsigned long)wp->nr_pages << PAGE_SHIFT;
+
+	return addr >= wp->first_page && addr - wp->first_page < size;
+}
+
+// Take an entry of the step pool, with swwp_lock held
+static struct swwp_step_entry *swwp_step_entry_alloc(void)
+{
+	unsigned int i = find_first_zero_bit(swwp_step_pool_used,
+					     RWMEM_SWWP_STEP_POOL_SIZE);
+
+	if (i == RWMEM_SWWP_STEP_POOL_SIZE) {
+		return NULL;
+	}
+	__set_bit(i, swwp_step_pool_used);
+	memset(&swwp_step_pool[i], 0, sizeof(swwp_step_pool[i]));
+	return &swwp_step_pool[i];
+}
+
+// Return an entry to the step pool, with swwp_lock held
+static void swwp_step_entry_free(struct swwp_step_entry *entry)
+{
+	__clear_bit(entry - swwp_step_pool, swwp_step_pool_used);
+}
+
+// Returns the locked pte of a present small page, NULL otherwise. The walk
+// does not need the mmap lock: interrupts stay off until swwp_pte_unlock,
+// so the page tables can not be freed under it, as in the fast gup walk.
+static pte_t *swwp_pte_lock(struct mm_struct *mm, unsigned long addr,
+			    spinlock_t **ptl, unsigned long *flags)
+{
+	pgd_t *pgd, pgdval;
+	p4d_t *p4d, p4dval;
+	pud_t *pud, pudval;
+	pmd_t *pmd, pmdval;
+	pte_t *pte;
+
+	local_irq_save(*flags);
+	pgd = pgd_offset(mm, addr);
+	pgdval = READ_ONCE(*pgd);
+	if (pgd_none(pgdval) || pgd_bad(pgdval)) {
+		goto fail;
+	}
+	p4d = p4d_offset(pgd, addr);
+	p4dval = READ_ONCE(*p4d);
+	if (p4d_none(p4dval) || p4d_bad(p4dval)) {
+		goto fail;
+	}
+	pud = pud_offset(p4d, addr);
+	pudval = READ_ONCE(*pud);
+	// huge pages are bad here and are not supported
+	if (pud_none(pudval) || pud_bad(pudval)) {
+		goto fail;
+	}
+	pmd = pmd_offset(pud, addr);
+	pmdval = READ_ONCE(*pmd);
+	if (pmd_none(pmdval) || pmd_bad(pmdval)) {
+		goto fail;
+	}
+	pte = pte_offset_map_lock(mm, pmd, addr, ptl);
+	if (!pte) {
+		goto fail;
+	}
+	if (!pte_present(*pte)) {
+		pte_unmap_unlock(pte, *ptl);
+		goto fail;
+	}
+	return pte;
+fail:
+	local_irq_restore(*flags);
+	return NULL;
+}
+
+static void swwp_pte_unlock(pte_t *pte, spinlock_t *ptl, unsigned long flags)
+{
+	pte_unmap_unlock(pte, ptl);
+	local_irq_restore(flags);
+}
+
+// Whether a page of [start, end) is or may be mapped by a huge page, which
+// can not be armed. With the mmap lock held.
+static bool swwp_range_huge(struct mm_struct *mm, unsigned long start,
+			    unsigned long end)
+{
+	struct vm_area_struct *vma;
+	unsigned long addr;
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		vma = find_vma(mm, addr);
+		if (vma && vma->vm_start <= addr && is_vm_hugetlb_page(vma)) {
+			return true;
+		}
+		pgd = pgd_offset(mm, addr);
+		if (pgd_none(*pgd) || pgd_bad(*pgd)) {
+			continue;
+		}
+		p4d = p4d_offset(pgd, addr);
+		if (p4d_none(*p4d) || p4d_bad(*p4d)) {
+			continue;
+		}
+		pud = pud_offset(p4d, addr);
+		if (pud_none(*pud)) {
+			continue;
+		}
+		// a block mapping is bad as a table
+		if (pud_bad(*pud)) {
+			return true;
+		}
+		pmd = pmd_offset(pud, addr);
+		if (!pmd_none(*pmd) && pmd_bad(*pmd)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// flush_tlb_page without a vma, which would need the mmap lock to look up
+static void swwp_flush_tlb_page(struct mm_struct *mm, unsigned long addr)
+{
+	struct vm_area_struct vma = TLB_FLUSH_VMA(mm, 0);
+
+	flush_tlb_page(&vma, addr);
+}
+
+static void swwp_arm_page(struct rwmem_swwp *wp, unsigned long addr)
+{
+	struct swwp_page *page = swwp_page(wp, addr);
+	unsigned long flags;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	if (page->armed) {
+		return;
+	}
+	// a page which is not present yet is armed after its first fault
+	pte = swwp_pte_lock(wp->mm, addr, &ptl, &flags);
+	if (!pte) {
+		return;
+	}
+	page->orig = *pte;
+	if (wp->type == HW_BREAKPOINT_W) {
+		page->armed_pte = pte_wrprotect(page->orig);
+	} else {
+		page->armed_pte = pte_modify(page->orig, PAGE_NONE);
+	}
+	set_pte_at(wp->mm, addr, pte, page->armed_pte);
+	page->armed = true;
+	swwp_pte_unlock(pte, ptl, flags);
+	swwp_flush_tlb_page(wp->mm, addr);
+}
+
+// Whether the page of a pte which was writable before it was armed may be
+// written through it again. A fork while the page was armed shares an
+// anonymous page with the child, and writeback may have cleaned a page
+// cache page, both need the write fault of the kernel.
+static bool swwp_may_write(pte_t pte)
+{
+	struct page *page;
+
+	if (!pfn_valid(pte_pfn(pte))) {
+		return false;
+	}
+	page = pfn_to_page(pte_pfn(pte));
+	if (!PageAnon(page)) {
+		return pte_dirty(pte);
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+	return PageAnonExclusive(page);
+#else
+	return page_mapcount(page) == 1;
+#endif
+}
+
+static pte_t swwp_mkwrite(pte_t pte)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+	return pte_mkwrite_novma(pte);
+#else
+	return pte_mkwrite(pte);
+#endif
+}
+
+// The pte of a disarmed page: the current pte (the kernel may have changed
+// its flags, fork write protects it) with only the permissions we removed
+// given back
+static pte_t swwp_disarmed_pte(struct rwmem_swwp *wp, struct swwp_page *page,
+			       pte_t pte)
+{
+	bool write = pte_write(page->orig) && swwp_may_write(pte);
+
+	if (wp->type != HW_BREAKPOINT_W) {
+		pte = pte_modify(pte, pte_pgprot(page->orig));
+		return write ? pte : pte_wrprotect(pte);
+	}
+	return write ? swwp_mkwrite(pte) : pte;
+}
+
+static void swwp_disarm_page(struct rwmem_swwp *wp, unsigned long addr)
+{
+	struct swwp_page *page = swwp_page(wp, addr);
+	unsigned long flags;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	if (!page->armed) {
+		return;
+	}
+	page->armed = false;
+	pte = swwp_pte_lock(wp->mm, addr, &ptl, &flags);
+	if (!pte) {
+		return;
+	}
+	// the kernel may have replaced the pte meanwhile (reclaim, migration,
+	// a copy on write), then there is nothing of ours left in it
+	if (pte_pfn(*pte) == pte_pfn(page->armed_pte) &&
+	    (wp->type == HW_BREAKPOINT_W ? !pte_write(*pte) :
+					   !pte_valid(*pte))) {
+		set_pte_at(wp->mm, addr, pte,
+			   swwp_disarmed_pte(wp, page, *pte));
+	}
+	swwp_pte_unlock(pte, ptl, flags);
+	swwp_flush_tlb_page(wp->mm, addr);
+}
+
+static void swwp_arm(struct rwmem_swwp *wp)
+{
+	unsigned long addr;
+	unsigned int i;
+
+	for (i = 0; i < wp->nr_pages; i++) {
+		addr = wp->first_page + ((unsigned long)i << PAGE_SHIFT);
+		swwp_arm_page(wp, addr);
+	}
+}
+
+static void swwp_rearm(struct callback_head *twork)
+{
+	struct swwp_step_entry *entry =
+		container_of(twork, struct swwp_step_entry, twork);
+	struct mm_struct *mm = current->mm;
+
+	// the task work also runs when the thread exits, after its mm is gone
+	if (mm) {
+		down_read(&mm->MM_STRUCT_MMAP_LOCK);
+	}
+	spin_lock(&swwp_lock);
+	list_del(&entry->list);
+	if (mm && entry->wp && entry->wp->enabled) {
+		swwp_arm_page(entry->wp, entry->addr);
+	}
+	swwp_step_entry_free(entry);
+	spin_unlock(&swwp_lock);
+	if (mm) {
+		up_read(&mm->MM_STRUCT_MMAP_LOCK);
+	}
+}
+
+int rwmem_swwp_install(struct file *file, uint8_t type, unsigned long addr,
+		       size_t len, bool disabled)
+{
+	struct rwmem_bp_private_data *data = file->private_data;
+	unsigned long first_page = addr & PAGE_MASK;
+	unsigned long end = addr + len;
+	struct rwmem_swwp *wp, *other;
+	struct mm_struct *mm;
+	unsigned int nr_pages;
+	int ret = 0;
+
+	if (!len || end < addr) {
+		return -EINVAL;
+	}
+	nr_pages = (PAGE_ALIGN(end) - first_page) >> PAGE_SHIFT;
+	if (nr_pages > RWMEM_SWWP_MAX_PAGES) {
+		return -E2BIG;
+	}
+	mm = get_task_mm(data->target_task);
+	if (!mm) {
+		return -ESRCH;
+	}
+	wp = kzalloc(struct_size(wp, pages, nr_pages), GFP_KERNEL);
+	if (!wp) {
+		mmput(mm);
+		return -ENOMEM;
+	}
+	mmgrab(mm);
+	wp->mm = mm;
+	wp->data = data;
+	wp->start = addr;
+	wp->end = end;
+	wp->first_page = first_page;
+	wp->type = type;
+	wp->enabled = !disabled;
+	wp->nr_pages = nr_pages;
+
+	down_read(&mm->MM_STRUCT_MMAP_LOCK);
+	if (swwp_range_huge(mm, first_page, PAGE_ALIGN(end))) {
+		ret = -EINVAL;
+		goto out;
+	}
+	spin_lock(&swwp_lock);
+	// a page is protected by one watchpoint only
+	list_for_each_entry (other, &swwp_list, list) {
+		if (other->mm == mm &&
+		    (swwp_covers(other, first_page) ||
+		     swwp_covers(wp, other->first_page))) {
+			ret = -EBUSY;
+			break;
+		}
+	}
+	if (!ret) {
+		list_add(&wp->list, &swwp_list);
+		atomic_inc(&swwp_count);
+		if (wp->enabled) {
+			swwp_arm(wp);
+		}
+		data->swwp = wp;
+	}
+	spin_unlock(&swwp_lock);
+out:
+	up_read(&mm->MM_STRUCT_MMAP_LOCK);
+	mmput(mm);
+
+	if (ret) {
+		mmdrop(mm);
+		kfree(wp);
+	}
+	return ret;
+}
+
+void rwmem_swwp_enable(struct rwmem_swwp *wp)
+{
+	if (!mmget_not_zero(wp->mm)) {
+		return;
+	}
+	down_read(&wp->mm->MM_STRUCT_MMAP_LOCK);
+	spin_lock(&swwp_lock);
+	wp->enabled = true;
+	swwp_arm(wp);
+	spin_unlock(&swwp_lock);
+	up_read(&wp->mm->MM_STRUCT_MMAP_LOCK);
+	mmput(wp->mm);
+}
+
+void rwmem_swwp_disable(struct rwmem_swwp *wp)
+{
+	unsigned int i;
+
+	if (!mmget_not_zero(wp->mm)) {
+		return;
+	}
+	down_read(&wp->mm->MM_STRUCT_MMAP_LOCK);
+	spin_lock(&swwp_lock);
+	wp->enabled = false;
+	for (i = 0; i < wp->nr_pages; i++) {
+		swwp_disarm_page(wp, wp->first_page +
+					     ((unsigned long)i << PAGE_SHIFT));
+	}
+	spin_unlock(&swwp_lock);
+	up_read(&wp->mm->MM_STRUCT_MMAP_LOCK);
+	mmput(wp->mm);
+}
+
+void rwmem_swwp_remove(struct rwmem_swwp *wp)
+{
+	struct swwp_step_entry *entry;
+	bool alive = mmget_not_zero(wp->mm);
+	unsigned int i;
+
+	if (alive) {
+		down_read(&wp->mm->MM_STRUCT_MMAP_LOCK);
+	}
+	spin_lock(&swwp_lock);
+	list_del(&wp->list);
+	atomic_dec(&swwp_count);
+	// pending steps still complete, but leave the pages alone
+	list_for_each_entry (entry, &swwp_step_list, list) {
+		if (entry->wp == wp) {
+			entry->wp = NULL;
+		}
+	}
+	for (i = 0; alive && i < wp->nr_pages; i++) {
+		swwp_disarm_page(wp, wp->first_page +
+					     ((unsigned long)i << PAGE_SHIFT));
+	}
+	spin_unlock(&swwp_lock);
+	if (alive) {
+		up_read(&wp->mm->MM_STRUCT_MMAP_LOCK);
+		mmput(wp->mm);
+	}
+	mmdrop(wp->mm);
+	kfree(wp);
+}
+
+// Called from the single step hook. Returns true if the current thread was
+// stepping over an access to a watched page.
+bool rwmem_swwp_step(void)
+{
+	struct swwp_step_entry *entry, *tmp;
+	bool found = false, keep_stepping = false;
+
+	spin_lock(&swwp_lock);
+	// one instruction may have touched several watched pages
+	list_for_each_entry_safe (entry, tmp, &swwp_step_list, list) {
+		if (entry->pid != current->pid || entry->queued) {
+			continue;
+		}
+		keep_stepping |= entry->was_stepping;
+		found = true;
+		entry->queued = true;
+		// the thread is exiting, the page walk does not need the task
+		// work to arm the page again
+		if (task_work_add(current, &entry->twork, TWA_RESUME)) {
+			if (entry->wp && entry->wp->enabled) {
+				swwp_arm_page(entry->wp, entry->addr);
+			}
+			list_del(&entry->list);
+			swwp_step_entry_free(entry);
+		}
+	}
+	if (found && !keep_stepping) {
+		user_disable_single_step(current);
+	}
+	spin_unlock(&swwp_lock);
+	return found;
+}
+
+// The fault hook, called for every fault on a user address. Returns 0 if
+// the fault is handled and the access is to be retried.
+int rwmem_swwp_fault(unsigned long addr, unsigned int esr,
+		     struct pt_regs *regs)
+{
+	struct rwmem_bp_private_data *data = NULL;
+	struct mm_struct *mm = current->mm;
+	struct swwp_step_entry *entry;
+	struct rwmem_swwp *wp, *found = NULL;
+	bool user = user_mode(regs);
+	bool is_write;
+	int ret = 1;
+
+	if (!atomic_read(&swwp_count) || !mm) {
+		return 1;
+	}
+	// instruction fetches are not watched
+	if (ESR_ELx_EC(esr) == ESR_ELx_EC_IABT_LOW) {
+		return 1;
+	}
+	is_write = (esr & ESR_ELx_WNR) && !(esr & ESR_ELx_CM);
+
+	// no mmap lock here, the page walk does not need it
+	spin_lock(&swwp_lock);
+	list_for_each_entry (wp, &swwp_list, list) {
+		if (wp->mm == mm && wp->enabled && swwp_covers(wp, addr)) {
+			found = wp;
+			break;
+		}
+	}
+	if (!found) {
+		goto out;
+	}
+	wp = found;
+	// the access faults again while the thread steps over it, this one is
+	// for the kernel to resolve (for example a copy on write)
+	list_for_each_entry (entry, &swwp_step_list, list) {
+		if (entry->pid == current->pid && entry->wp == wp &&
+		    entry->addr == (addr & PAGE_MASK)) {
+			goto out;
+		}
+	}
+
+	// empty only with RWMEM_SWWP_STEP_POOL_SIZE threads stepping at once
+	entry = swwp_step_entry_alloc();
+	if (!entry) {
+		goto out;
+	}
+	entry->pid = current->pid;
+	entry->wp = wp;
+	entry->addr = addr & PAGE_MASK;
+	init_task_work(&entry->twork, swwp_rearm);
+	list_add(&entry->list, &swwp_step_list);
+	if (swwp_page(wp, addr)->armed) {
+		swwp_disarm_page(wp, entry->addr);
+		ret = 0;
+	}
+	if (user) {
+		// armed again by rwmem_swwp_step after the access
+		entry->was_stepping = test_thread_flag(TIF_SINGLESTEP);
+		if (!entry->was_stepping) {
+			user_enable_single_step(current);
+		}
+	} else {
+		// a user access of the kernel can not be stepped, arm the page
+		// again when the thread returns to user space. An exiting thread
+		// leaves the page disarmed until the watchpoint is enabled again.
+		entry->queued = true;
+		if (task_work_add(current, &entry->twork, TWA_RESUME)) {
+			list_del(&entry->list);
+			swwp_step_entry_free(entry);
+		}
+	}
+
+	if (addr >= wp->start && addr < wp->end &&
+	    (wp->type == HW_BREAKPOINT_RW ||
+	     (wp->type == HW_BREAKPOINT_W) == is_write)) {
+		data = wp->data;
+		refcount_inc(&data->ref);
+	}
+out:
+	spin_unlock(&swwp_lock);
+
+	if (data) {
+		rwmem_bp_hit(data, user ? regs : task_pt_regs(current), addr);
+		rwmem_bp_put(data);
+	}
+	return ret;
+}
@@ -0,0 +1,28 @@
+#ifndef _KERNEL_RWMEM_SWWP_H_
+#define _KERNEL_RWMEM_SWWP_H_
+
+#include "linux/fs.h"
+#include "linux/types.h"
+#include "asm/ptrace.h"
+
+// Software watchpoints protect the pages covering the watched range in the
+// page tables of the target. A fault on such a page restores the page,
+// steps the thread over the access and protects the page again. Accesses
+// inside the range are reported like hits of a hardware watchpoint. A range
+// mapped by huge pages is refused with -EINVAL.
+
+// most pages one software watchpoint can cover
+#define RWMEM_SWWP_MAX_PAGES 512
+
+struct rwmem_swwp;
+
+int rwmem_swwp_install(struct file *file, uint8_t type, unsigned long addr,
+		       size_t len, bool disabled);
+void rwmem_swwp_enable(struct rwmem_swwp *wp);
+void rwmem_swwp_disable(struct rwmem_swwp *wp);
+void rwmem_swwp_remove(struct rwmem_swwp *wp);
+bool rwmem_swwp_step(void);
+int rwmem_swwp_fault(unsigned long addr, unsigned int esr,
+		     struct pt_regs *regs);
+
+#endif
@@ -1,18 +1,92 @@
 #include "sys.h"
 #include "api_proxy.h"
 #include "asm/debug-monitors.h"
+#include "asm/exception.h"
 #include "bp.h"
 #include "linux/fdtable.h"
 #include "linux/file.h"
 #include "linux/hw_breakpoint.h"
 #include "linux/kern_levels.h"
 #include "linux/pid.h"
+#include "linux/pipe_fs_i.h"
 #include "linux/printk.h"
+#include "linux/sched/mm.h"
+#include "linux/sched/signal.h"
+#include "linux/sched/task_stack.h"
 #include "linux/slab.h"
+#include "linux/splice.h"
 #include "linux/types.h"
 #include "linux/wait.h"
 #include "phy_mem.h"
 #include "proc_maps.h"
+#include "stats.h"
+#include "freeze.h"
+#include "swbp.h"
+#include "swwp.h"
+
+#define CREATE_TRACE_POINTS
+#include "rwmem_trace.h"
+
+#ifdef CONFIG_RWMEM_STATS
+const char *const rwmem_stat_names[RWMEM_STAT_NR] = {
+	[RWMEM_STAT_READ] = "read",
+	[RWMEM_STAT_WRITE] = "write",
+	[RWMEM_STAT_PAGE_WALK] = "page_walk",
+	[RWMEM_STAT_PHY_READ] = "phy_read",
+	[RWMEM_STAT_PHY_WRITE] = "phy_write",
+	[RWMEM_STAT_BP_HIT] = "bp_hit",
+	[RWMEM_STAT_BP_STEP] = "bp_step",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_GET_PROCESS_MAPS_COUNT)] =
+		"ioctl_get_process_maps_count",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_GET_PROCESS_MAPS_LIST)] =
+		"ioctl_get_process_maps_list",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_CHECK_PROCESS_ADDR_PHY)] =
+		"ioctl_check_process_addr_phy",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_ADD_BP)] = "ioctl_add_bp",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_GET_NUM_BRPS)] = "ioctl_get_num_brps",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_GET_NUM_WRPS)] = "ioctl_get_num_wrps",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_READ_TO_PIPE)] = "ioctl_read_to_pipe",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_ADD_SWWP)] = "ioctl_add_swwp",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_CREATE_BP_QUEUE)] =
+		"ioctl_create_bp_queue",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_ADD_BP_BATCH)] = "ioctl_add_bp_batch",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_ADD_SWBP)] = "ioctl_add_swbp",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_FREEZE)] = "ioctl_freeze",
+	[RWMEM_STAT_IOCTL + _IOC_NR(IOCTL_SNAPSHOT_THREADS)] =
+		"ioctl_snapshot_threads",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_CONTINUE)] = "bp_ioctl_continue",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_REG)] = "bp_ioctl_set_reg",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_SIMD_REG)] =
+		"bp_ioctl_set_simd_reg",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_STEP)] = "bp_ioctl_step",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_IS_STOPPED)] =
+		"bp_ioctl_is_stopped",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_ENABLE)] = "bp_ioctl_enable",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_LOG)] = "bp_ioctl_set_log",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_COND)] = "bp_ioctl_set_cond",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_HIT_POLICY)] =
+		"bp_ioctl_set_hit_policy",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_GET_HIT_COUNT)] =
+		"bp_ioctl_get_hit_count",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_AGGR)] = "bp_ioctl_set_aggr",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_READ_AGGR)] =
+		"bp_ioctl_read_aggr",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_STEP_EX)] = "bp_ioctl_step_ex",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_TRACE)] = "bp_ioctl_set_trace",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_GET_POOL_STATS)] =
+		"bp_ioctl_get_pool_stats",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_QUEUE)] = "bp_ioctl_set_queue",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_RESUME)] = "bp_ioctl_resume",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_ACTIONS)] =
+		"bp_ioctl_set_actions",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_DISABLE)] = "bp_ioctl_disable",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_MODIFY)] = "bp_ioctl_modify",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_SET_STACKS)] =
+		"bp_ioctl_set_stacks",
+	[RWMEM_STAT_BP_IOCTL + _IOC_NR(IOCTL_BP_READ_STACKS)] =
+		"bp_ioctl_read_stacks",
+};
+#endif
 
 int rwmem_open(struct inode *inode, struct file *filp)
 {
@@ -24,8 +98,8 @@ int rwmem_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
-ssize_t rwmem_read(struct file *filp, char __user *buf, size_t size,
-		   loff_t *ppos)
+static ssize_t do_rwmem_read(struct file *filp, char __user *buf,
+			     size_t size, loff_t *ppos)
 {
 	char data[17] = { 0 };
 	unsigned long read = x_copy_from_user(data, buf, 17);
@@ -35,6 +109,7 @@ ssize_t rwmem_read(struct file *filp, char __user *buf, size_t size,
 		bool is_force_read = data[16] == '\x01' ? true : false;
 		size_t read_size = 0;
 		struct pid *pid_struct = find_get_pid(pid);
+		trace_rwmem_read(pid, proc_virt_addr, size, is_force_read);
 		if (!pid_struct) {
 			return -EINVAL;
 		}
@@ -60,6 +135,7 @@ ssize_t rwmem_read(struct file *filp, char __user *buf, size_t size,
 			printk_debug(KERN_INFO "calc phy_addr:0x%zx\n",
 				     phy_addr);
 			if (phy_addr == 0) {
+				rwmem_stat_not_present(RWMEM_STAT_READ);
 				break;
 			}
 
@@ -102,8 +178,18 @@ ssize_t rwmem_read(struct file *filp, char __user *buf, size_t size,
 	return -EFAULT;
 }
 
-ssize_t rwmem_write(struct file *filp, const char __user *buf, size_t size,
-		    loff_t *ppos)
+ssize_t rwmem_read(struct file *filp, char __user *buf, size_t size,
+		   loff_t *ppos)
+{
+	u64 start = rwmem_stat_begin();
+	ssize_t ret = do_rwmem_read(filp, buf, size, ppos);
+	trace_rwmem_read_done(ret);
+	rwmem_stat_end(RWMEM_STAT_READ, start, ret, ret > 0 ? ret : 0);
+	return ret;
+}
+
+static ssize_t do_rwmem_write(struct file *filp, const char __user *buf,
+			      size_t size, loff_t *ppos)
 {
 	char data[17] = { 0 };
 	unsigned long write = x_copy_from_user(data, buf, 17);
@@ -113,6 +199,7 @@ ssize_t rwmem_write(struct file *filp, const char __user *buf, size_t size,
 		bool is_force_write = data[16] == '\x01' ? true : false;
 		size_t write_size = 0;
 		struct pid *pid_struct = find_get_pid(pid);
+		trace_rwmem_write(pid, proc_virt_addr, size, is_force_write);
 		if (!pid_struct) {
 			return -EINVAL;
 		}
@@ -138,6 +225,7 @@ ssize_t rwmem_write(struct file *filp, const char __user *buf, size_t size,
 
 			printk_debug(KERN_INFO "phy_addr:0x%zx\n", phy_addr);
 			if (phy_addr == 0) {
+				rwmem_stat_not_present(RWMEM_STAT_WRITE);
 				break;
 			}
 
@@ -180,7 +268,399 @@ ssize_t rwmem_write(struct file *filp, const char __user *buf, size_t size,
 	return -EFAULT;
 }
 
-long rwmem_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+ssize_t rwmem_write(struct file *filp, const char __user *buf, size_t size,
+		    loff_t *ppos)
+{
+	u64 start = rwmem_stat_begin();
+	ssize_t ret = do_rwmem_write(filp, buf, size, ppos);
+	trace_rwmem_write_done(ret);
+	rwmem_stat_end(RWMEM_STAT_WRITE, start, ret, ret > 0 ? ret : 0);
+	return ret;
+}
+
+// The pipe only holds references to the target's pages, so nothing is copied
+// until the reader splices them somewhere else (e.g. a socket).
+static const struct pipe_buf_operations rwmem_pipe_buf_ops = {
+	.release = generic_pipe_buf_release,
+	.get = generic_pipe_buf_get,
+};
+
+static void rwmem_spd_release(struct splice_pipe_desc *spd, unsigned int i)
+{
+	put_page(spd->pages[i]);
+}
+
+static ssize_t rwmem_read_to_pipe(struct pid *pid_struct, size_t proc_virt_addr,
+				  size_t size, bool is_force_read,
+				  struct pipe_inode_info *pipe)
+{
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.ops = &rwmem_pipe_buf_ops,
+		.spd_release = rwmem_spd_release,
+	};
+	struct task_struct *task;
+	struct mm_struct *mm;
+	size_t read_size = 0;
+	ssize_t ret = 0;
+	bool done = false;
+
+	task = get_pid_task(pid_struct, PIDTYPE_PID);
+	if (!task) {
+		return 0;
+	}
+	mm = get_task_mm(task);
+	put_task_struct(task);
+	if (!mm) {
+		return 0;
+	}
+
+	pipe_lock(pipe);
+	while (!done && read_size < size) {
+		unsigned long addr = proc_virt_addr + read_size;
+		size_t left = size - read_size;
+		size_t batch_size = 0;
+		long nr_pages, i;
+
+		nr_pages = min_t(size_t, PIPE_DEF_BUFFERS,
+				 (PAGE_ALIGN(addr + left) - (addr & PAGE_MASK)) >>
+					 PAGE_SHIFT);
+		// the pages are pinned with the mmap lock held, so they can not
+		// be freed under the pipe. A force read gets the pages of a
+		// mapping without read permission, like ptrace.
+		down_read(&mm->MM_STRUCT_MMAP_LOCK);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+		ret = get_user_pages_remote(mm, addr & PAGE_MASK, nr_pages,
+					    is_force_read ? FOLL_FORCE : 0,
+					    pages, NULL);
+#else
+		ret = get_user_pages_remote(mm, addr & PAGE_MASK, nr_pages,
+					    is_force_read ? FOLL_FORCE : 0,
+					    pages, NULL, NULL);
+#endif
+		up_read(&mm->MM_STRUCT_MMAP_LOCK);
+		if (ret <= 0) {
+			rwmem_stat_not_present(RWMEM_STAT_IOCTL +
+					       _IOC_NR(IOCTL_READ_TO_PIPE));
+			ret = 0;
+			break;
+		}
+		// stop at the first page which could not be pinned
+		done = ret < nr_pages;
+		spd.nr_pages = ret;
+		for (i = 0; i < spd.nr_pages; i++) {
+			partial[i].offset = i ? 0 : addr & ~PAGE_MASK;
+			partial[i].len = min_t(size_t,
+					       PAGE_SIZE - partial[i].offset,
+					       left - batch_size);
+			batch_size += partial[i].len;
+		}
+
+		// splice_to_pipe drops the references it could not queue
+		ret = splice_to_pipe(pipe, &spd);
+		if (ret <= 0) {
+			break;
+		}
+		read_size += ret;
+		if ((size_t)ret < batch_size) {
+			// the pipe is full
+			break;
+		}
+	}
+	pipe_unlock(pipe);
+
+	if (read_size) {
+		wake_up_interruptible_sync_poll(&pipe->rd_wait,
+						EPOLLIN | EPOLLRDNORM);
+		kill_fasync(&pipe->fasync_readers, SIGIO, POLL_IN);
+	}
+	mmput(mm);
+	return read_size ? read_size : ret;
+}
+
+// Create a hardware bp file with its events installed, the caller gives it
+// an fd
+static struct file *rwmem_create_bp(struct bp_add_param *param)
+{
+	struct rwmem_bp_private_data *private_data;
+	struct perf_event_attr attr;
+	struct pid *pid_struct;
+	struct task_struct *task;
+	uint64_t bp_addr, bp_len;
+	struct file *file;
+	int ret;
+
+	if (param->type > 4) {
+		return ERR_PTR(-EINVAL);
+	}
+	if (param->flags & RWMEM_BP_FLAG_RANGE) {
+		if (param->type == HW_BREAKPOINT_X ||
+		    rwmem_bp_range(param->virt_addr, param->range_len, &bp_addr,
+				   &bp_len)) {
+			return ERR_PTR(-EINVAL);
+		}
+	} else {
+		if (param->len != 1 && param->len != 2 && param->len != 4 &&
+		    param->len != 8) {
+			return ERR_PTR(-EINVAL);
+		}
+		bp_addr = param->virt_addr;
+		bp_len = param->len;
+	}
+	// the inherited events of a process bp could never be armed
+	if ((param->flags & RWMEM_BP_FLAG_PROCESS) &&
+	    (param->flags & RWMEM_BP_FLAG_DISABLED)) {
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	pid_struct = find_get_pid(param->pid);
+	if (!pid_struct) {
+		return ERR_PTR(-EINVAL);
+	}
+	task = get_pid_task(pid_struct, PIDTYPE_PID);
+	put_pid(pid_struct);
+	if (!task) {
+		return ERR_PTR(-EINVAL);
+	}
+
+	hw_breakpoint_init(&attr);
+	attr.exclude_kernel = 1;
+	attr.bp_addr = bp_addr;
+	attr.bp_len = bp_len;
+	attr.bp_type = param->type;
+	attr.disabled = !!(param->flags & RWMEM_BP_FLAG_DISABLED);
+	file = create_rwmem_bp_file();
+	if (IS_ERR(file)) {
+		put_task_struct(task);
+		return file;
+	}
+
+	// the file owns the task from now on
+	private_data = file->private_data;
+	private_data->target_task = task;
+	if (param->flags & RWMEM_BP_FLAG_RANGE) {
+		private_data->range_start = param->virt_addr;
+		private_data->range_end = param->virt_addr + param->range_len;
+	}
+	ret = rwmem_bp_install(file, &attr,
+			       !!(param->flags & RWMEM_BP_FLAG_PROCESS));
+	if (ret) {
+		fput(file);
+		return ERR_PTR(ret);
+	}
+	return file;
+}
+
+// Create many bps at once. Every entry gets its fd or error in result, the
+// fds are only installed when the batch is done, so an atomic batch which
+// fails leaves nothing behind. Returns the number of bps created.
+static long rwmem_add_bp_batch(unsigned long arg)
+{
+	struct bp_batch_entry *entries;
+	struct bp_batch_param param;
+	struct file **files;
+	long created = 0, ret = 0;
+	uint32_t i, j;
+
+	if (x_copy_from_user((void *)&param, (void *)arg, sizeof(param))) {
+		return -EFAULT;
+	}
+	if (!param.count || param.count > RWMEM_BP_BATCH_MAX ||
+	    param.flags & ~RWMEM_BP_BATCH_ATOMIC) {
+		return -EINVAL;
+	}
+	entries = kvmalloc_array(param.count, sizeof(*entries), GFP_KERNEL);
+	files = kvcalloc(param.count, sizeof(*files), GFP_KERNEL);
+	if (!entries || !files) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (x_copy_from_user(entries, (void *)param.entries,
+			     sizeof(*entries) * param.count)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < param.count; i++) {
+		entries[i].result = get_unused_fd_flags(O_CLOEXEC);
+		if (entries[i].result < 0) {
+			ret = entries[i].result;
+		} else {
+			files[i] = rwmem_create_bp(&entries[i].bp);
+			if (IS_ERR(files[i])) {
+				put_unused_fd(entries[i].result);
+				entries[i].result = PTR_ERR(files[i]);
+				ret = entries[i].result;
+				files[i] = NULL;
+			}
+		}
+		if (ret && (param.flags & RWMEM_BP_BATCH_ATOMIC)) {
+			break;
+		}
+	}
+
+	if (ret && (param.flags & RWMEM_BP_BATCH_ATOMIC)) {
+		// undo the whole batch, the failed entry keeps its error
+		for (j = i + 1; j < param.count; j++) {
+			entries[j].result = -ECANCELED;
+		}
+		while (i--) {
+			put_unused_fd(entries[i].result);
+			fput(files[i]);
+			entries[i].result = -ECANCELED;
+		}
+		// the fds are gone already, but the caller can not tell which
+		// entry failed
+		if (x_copy_to_user((void *)param.entries, entries,
+				   sizeof(*entries) * param.count)) {
+			ret = -EFAULT;
+		}
+		goto out;
+	}
+	if (x_copy_to_user((void *)param.entries, entries,
+			   sizeof(*entries) * param.count)) {
+		// nobody would learn the fds
+		for (i = 0; i < param.count; i++) {
+			if (files[i]) {
+				put_unused_fd(entries[i].result);
+				fput(files[i]);
+			}
+		}
+		ret = -EFAULT;
+		goto out;
+	}
+	for (i = 0; i < param.count; i++) {
+		if (files[i]) {
+			fd_install(entries[i].result, files[i]);
+			created++;
+		}
+	}
+	ret = created;
+out:
+	kvfree(files);
+	kvfree(entries);
+	return ret;
+}
+
+// Fill rec with the registers and the top of the stack of t
+static void rwmem_snapshot_thread(struct task_struct *t, struct mm_struct *mm,
+				  struct thread_snapshot *rec,
+				  uint32_t stack_len)
+{
+	struct pt_regs *regs;
+	unsigned long sp;
+	int copied;
+
+	memset(rec, 0, sizeof(*rec) + stack_len);
+	rec->tid = t->pid;
+	// the stack holding the registers is freed when the thread exits
+	if (!try_get_task_stack(t)) {
+		return;
+	}
+	if (task_curr(t)) {
+		rec->flags |= RWMEM_SNAPSHOT_RUNNING;
+	}
+	regs = task_pt_regs(t);
+	rec->regs = regs->user_regs;
+	sp = compat_user_mode(regs) ? regs->compat_sp : regs->sp;
+	put_task_stack(t);
+
+	if (stack_len) {
+		copied = access_remote_vm(mm, sp, rec + 1, stack_len,
+					  FOLL_FORCE);
+		rec->stack_valid = copied > 0 ? copied : 0;
+	}
+}
+
+// Copy the registers and the top of the user stack of every thread of a
+// process, returns the number of records written
+static long rwmem_snapshot_threads(unsigned long arg)
+{
+	struct thread_snapshot_param param;
+	struct thread_snapshot *rec = NULL;
+	struct task_struct **tasks = NULL, *leader, *t;
+	struct mm_struct *mm;
+	struct pid *pid_struct;
+	unsigned int nr_tasks = 0, max_tasks, i;
+	size_t record_size;
+	long ret = 0;
+
+	if (x_copy_from_user((void *)&param, (void *)arg, sizeof(param))) {
+		return -EFAULT;
+	}
+	if (param.stack_len > RWMEM_SNAPSHOT_MAX_STACK ||
+	    param.stack_len % 8) {
+		return -EINVAL;
+	}
+
+	pid_struct = find_get_pid(param.pid);
+	if (!pid_struct) {
+		return -EINVAL;
+	}
+	leader = get_pid_task(pid_struct, PIDTYPE_PID);
+	put_pid(pid_struct);
+	if (!leader) {
+		return -EINVAL;
+	}
+	mm = get_task_mm(leader);
+	if (!mm) {
+		put_task_struct(leader);
+		return -EINVAL;
+	}
+
+	param.threads = get_nr_threads(leader);
+	max_tasks = min(param.threads, param.max_threads);
+	record_size = sizeof(*rec) + param.stack_len;
+	if (max_tasks) {
+		tasks = kcalloc(max_tasks, sizeof(*tasks), GFP_KERNEL);
+		rec = kvmalloc(record_size, GFP_KERNEL);
+		if (!tasks || !rec) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+	rcu_read_lock();
+	for_each_thread (leader, t) {
+		if (nr_tasks == max_tasks) {
+			break;
+		}
+		get_task_struct(t);
+		tasks[nr_tasks++] = t;
+	}
+	rcu_read_unlock();
+
+	for (i = 0; i < nr_tasks; i++) {
+		if (!ret) {
+			rwmem_snapshot_thread(tasks[i], mm, rec,
+					      param.stack_len);
+			if (x_copy_to_user((void *)(param.buf +
+						    i * record_size),
+					   rec, record_size)) {
+				ret = -EFAULT;
+			}
+		}
+		put_task_struct(tasks[i]);
+	}
+	if (!ret && x_copy_to_user((void *)arg, &param, sizeof(param))) {
+		ret = -EFAULT;
+	}
+	if (!ret) {
+		ret = nr_tasks;
+	}
+out:
+	kvfree(rec);
+	kfree(tasks);
+	mmput(mm);
+	put_task_struct(leader);
+	return ret;
+}
+
+static long do_rwmem_ioctl(struct file *filp, unsigned int cmd,
+			   unsigned long arg)
 {
 	switch (cmd) {
 	case IOCTL_GET_PROCESS_MAPS_COUNT: {
@@ -300,28 +780,63 @@ long rwmem_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		return pages;
 	}
 	case IOCTL_ADD_BP: {
+		struct bp_add_param param;
+		struct file *file;
+		int fd;
+		// range_len is only passed along with its flag
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     offsetof(typeof(param), range_len))) {
+			return -EFAULT;
+		}
+		if (param.flags & RWMEM_BP_FLAG_RANGE) {
+			if (x_copy_from_user(
+				    (void *)&param.range_len,
+				    (void *)(arg + offsetof(typeof(param),
+							    range_len)),
+				    sizeof(param.range_len))) {
+				return -EFAULT;
+			}
+		}
+
+		fd = get_unused_fd_flags(O_CLOEXEC);
+		if (fd < 0) {
+			return fd;
+		}
+		file = rwmem_create_bp(&param);
+		if (IS_ERR(file)) {
+			put_unused_fd(fd);
+			return PTR_ERR(file);
+		}
+		fd_install(fd, file);
+		return fd;
+	}
+	case IOCTL_ADD_BP_BATCH: {
+		return rwmem_add_bp_batch(arg);
+	}
+	case IOCTL_SNAPSHOT_THREADS: {
+		return rwmem_snapshot_threads(arg);
+	}
+	case IOCTL_ADD_SWWP: {
 		struct {
 			pid_t pid;
 			uint8_t type;
-			uint8_t len;
+			uint8_t flags;
 			size_t virt_addr;
+			size_t len;
 		} param;
-		struct perf_event_attr attr;
 		struct pid *pid_struct;
 		struct task_struct *task;
-		struct perf_event *bp;
 		struct file *file;
-		struct rwmem_bp_private_data * private_data;
-		int fd;
+		struct rwmem_bp_private_data *private_data;
+		int fd, ret;
 		if (x_copy_from_user((void *)&param, (void *)arg,
 				     sizeof(param))) {
 			return -EFAULT;
 		}
-		if (param.type > 4) {
-			return -EINVAL;
-		}
-		if (param.len != 1 && param.len != 2 && param.len != 4 &&
-		    param.len != 8) {
+		// execution is watched by the hardware only
+		if (param.type != HW_BREAKPOINT_R &&
+		    param.type != HW_BREAKPOINT_W &&
+		    param.type != HW_BREAKPOINT_RW) {
 			return -EINVAL;
 		}
 
@@ -335,12 +850,6 @@ long rwmem_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			return -EINVAL;
 		}
 
-		hw_breakpoint_init(&attr);
-		attr.exclude_kernel = 1;
-		attr.bp_addr = param.virt_addr;
-		attr.bp_len = param.len;
-		attr.bp_type = param.type;
-		attr.disabled = 0;
 		fd = get_unused_fd_flags(O_CLOEXEC);
 		if (fd < 0) {
 			put_task_struct(task);
@@ -354,36 +863,206 @@ long rwmem_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		fd_install(fd, file);
 
-		bp = perf_event_create_kernel_counter(
-			&attr, -1, task, bp_callback,
-			(void *)(((uint64_t)file & ~((uint64_t)~((uint8_t)0xcb) << 56))));
-		if (IS_ERR(bp)) {
-			put_task_struct(task);
+		// the file owns the task from now on
+		private_data = file->private_data;
+		private_data->target_task = task;
+		ret = rwmem_swwp_install(
+			file, param.type, param.virt_addr, param.len,
+			!!(param.flags & RWMEM_BP_FLAG_DISABLED));
+		if (ret) {
 			close_fd(fd);
-			return PTR_ERR(bp);
+			return ret;
 		}
+
+		return fd;
+	}
+	case IOCTL_ADD_SWBP: {
+		struct {
+			pid_t pid;
+			uint8_t flags;
+			size_t virt_addr;
+		} param;
+		struct pid *pid_struct;
+		struct task_struct *task;
+		struct file *file;
+		struct rwmem_bp_private_data *private_data;
+		int fd, ret;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+
+		pid_struct = find_get_pid(param.pid);
+		if (!pid_struct) {
+			return -EINVAL;
+		}
+		task = get_pid_task(pid_struct, PIDTYPE_PID);
+		put_pid(pid_struct);
+		if (!task) {
+			return -EINVAL;
+		}
+
+		fd = get_unused_fd_flags(O_CLOEXEC);
+		if (fd < 0) {
+			put_task_struct(task);
+			return fd;
+		}
+		file = create_rwmem_bp_file();
+		if (IS_ERR(file)) {
+			put_task_struct(task);
+			put_unused_fd(fd);
+			return PTR_ERR(file);
+		}
+		fd_install(fd, file);
+
+		// the file owns the task from now on
 		private_data = file->private_data;
-		private_data->event = bp;
 		private_data->target_task = task;
+		ret = rwmem_swbp_install(
+			file, param.virt_addr,
+			!!(param.flags & RWMEM_BP_FLAG_DISABLED));
+		if (ret) {
+			close_fd(fd);
+			return ret;
+		}
 
 		return fd;
 	}
+	case IOCTL_CREATE_BP_QUEUE: {
+		struct file *file;
+		int fd;
+
+		fd = get_unused_fd_flags(O_CLOEXEC);
+		if (fd < 0) {
+			return fd;
+		}
+		file = rwmem_bp_queue_create(arg);
+		if (IS_ERR(file)) {
+			put_unused_fd(fd);
+			return PTR_ERR(file);
+		}
+		fd_install(fd, file);
+		return fd;
+	}
+	case IOCTL_FREEZE: {
+		struct freeze_param param;
+		struct pid *pid_struct;
+		struct task_struct *task;
+		struct file *file;
+		int fd;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+
+		pid_struct = find_get_pid(param.pid);
+		if (!pid_struct) {
+			return -EINVAL;
+		}
+		task = get_pid_task(pid_struct, PIDTYPE_PID);
+		put_pid(pid_struct);
+		if (!task) {
+			return -EINVAL;
+		}
+
+		fd = get_unused_fd_flags(O_CLOEXEC);
+		if (fd < 0) {
+			put_task_struct(task);
+			return fd;
+		}
+		file = rwmem_freeze_create(task, &param);
+		put_task_struct(task);
+		if (IS_ERR(file)) {
+			put_unused_fd(fd);
+			return PTR_ERR(file);
+		}
+		fd_install(fd, file);
+		return fd;
+	}
 	case IOCTL_GET_NUM_BRPS: {
 		return ((read_cpuid(ID_AA64DFR0_EL1) >> 12) & 0xf) + 1;
 	}
 	case IOCTL_GET_NUM_WRPS: {
 		return ((read_cpuid(ID_AA64DFR0_EL1) >> 20) & 0xf) + 1;
 	}
+	case IOCTL_READ_TO_PIPE: {
+		struct {
+			pid_t pid;
+			int pipe_fd;
+			size_t virt_addr;
+			size_t size;
+			uint8_t is_force_read;
+		} param;
+		struct pid *pid_struct;
+		struct pipe_inode_info *pipe;
+		struct fd pipe_fd;
+		ssize_t ret;
+		if (x_copy_from_user((void *)&param, (void *)arg,
+				     sizeof(param))) {
+			return -EFAULT;
+		}
+		if (param.size == 0) {
+			return 0;
+		}
+
+		pipe_fd = fdget(param.pipe_fd);
+		if (!pipe_fd.file) {
+			return -EBADF;
+		}
+		pipe = get_pipe_info(pipe_fd.file, true);
+		if (!pipe || !(pipe_fd.file->f_mode & FMODE_WRITE)) {
+			fdput(pipe_fd);
+			return -EBADF;
+		}
+
+		pid_struct = find_get_pid(param.pid);
+		if (!pid_struct) {
+			fdput(pipe_fd);
+			return -EINVAL;
+		}
+		if (!param.is_force_read &&
+		    !check_proc_map_can_read(pid_struct, param.virt_addr,
+					     param.size)) {
+			put_pid(pid_struct);
+			fdput(pipe_fd);
+			return -EFAULT;
+		}
+
+		ret = rwmem_read_to_pipe(pid_struct, param.virt_addr,
+					 param.size, param.is_force_read, pipe);
+		put_pid(pid_struct);
+		fdput(pipe_fd);
+		return ret;
+	}
 	default:
 		return -EINVAL;
 	}
 	return -EINVAL;
 }
 
+long rwmem_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	u64 start = rwmem_stat_begin();
+	long ret = do_rwmem_ioctl(filp, cmd, arg);
+	rwmem_stat_end(rwmem_stat_ioctl_id(RWMEM_STAT_IOCTL, cmd), start, ret,
+		       cmd == IOCTL_READ_TO_PIPE && ret > 0 ? ret : 0);
+	return ret;
+}
+
 static struct step_hook rwmem_bp_step_hook = {
 	.fn = rwmem_bp_step_handler,
 };
 
+static struct break_hook rwmem_swbp_break_hook = {
+	.fn = rwmem_swbp_brk_handler,
+	.imm = RWMEM_SWBP_BRK_IMM,
+};
+
+static struct break_hook rwmem_swbp_xol_break_hook = {
+	.fn = rwmem_swbp_xol_brk_handler,
+	.imm = RWMEM_SWBP_XOL_BRK_IMM,
+};
+
 
 static int __init rwmem_dev_init(void)
 {
@@ -420,6 +1099,10 @@ static int __init rwmem_dev_init(void)
 	device_create(g_Class_devp, NULL, g_rwProcMem_devno, NULL, "%s",
 		      DEV_FILENAME);
 	register_user_step_hook(&rwmem_bp_step_hook);
+	register_user_fault_hook(rwmem_swwp_fault);
+	register_user_break_hook(&rwmem_swbp_break_hook);
+	register_user_break_hook(&rwmem_swbp_xol_break_hook);
+	rwmem_stats_init();
 	return 0;
 _fail:
 	unregister_chrdev_region(g_rwProcMem_devno, 1);
@@ -428,12 +1111,16 @@ _fail:
 
 static void __exit rwmem_dev_exit(void)
 {
+	rwmem_stats_exit();
 	device_destroy(g_Class_devp, g_rwProcMem_devno);
 	class_destroy(g_Class_devp);
 
 	cdev_del(g_rwProcMem_devp->pcdev);
 	unregister_chrdev_region(g_rwProcMem_devno, 1);
 	unregister_user_step_hook(&rwmem_bp_step_hook);
+	unregister_user_fault_hook(rwmem_swwp_fault);
+	unregister_user_break_hook(&rwmem_swbp_break_hook);
+	unregister_user_break_hook(&rwmem_swbp_xol_break_hook);
 	kfree(g_rwProcMem_devp->pcdev);
 	kfree(g_rwProcMem_devp);
 	printk(KERN_INFO "unload %s\n", DEV_FILENAME);
@@ -26,6 +26,42 @@
 #define IOCTL_ADD_BP _IOWR(RWMEM_MAJOR_NUM, 3, char *)
 #define IOCTL_GET_NUM_BRPS _IO(RWMEM_MAJOR_NUM, 4)
 #define IOCTL_GET_NUM_WRPS _IO(RWMEM_MAJOR_NUM, 5)
+#define IOCTL_READ_TO_PIPE _IOWR(RWMEM_MAJOR_NUM, 6, char *)
+#define IOCTL_ADD_SWWP _IOWR(RWMEM_MAJOR_NUM, 7, char *)
+// arg is the capacity in events, returns the queue fd
+#define IOCTL_CREATE_BP_QUEUE _IO(RWMEM_MAJOR_NUM, 8)
+// returns the number of bps created, see struct bp_batch_param
+#define IOCTL_ADD_BP_BATCH _IOWR(RWMEM_MAJOR_NUM, 9, char *)
+// a software execute breakpoint, returns the bp fd
+#define IOCTL_ADD_SWBP _IOWR(RWMEM_MAJOR_NUM, 10, char *)
+// park every thread of a process, returns the freeze fd, see freeze.h
+#define IOCTL_FREEZE _IOWR(RWMEM_MAJOR_NUM, 11, char *)
+// returns the number of threads written, see struct thread_snapshot_param
+#define IOCTL_SNAPSHOT_THREADS _IOWR(RWMEM_MAJOR_NUM, 12, char *)
+
+#define RWMEM_SNAPSHOT_MAX_STACK 65536
+
+// flags of thread_snapshot
+// the thread was on a cpu, its registers are those of its last entry into
+// the kernel. Freeze the process first for exact registers.
+#define RWMEM_SNAPSHOT_RUNNING 0x1
+
+// One record per thread, followed by stack_len bytes of the stack from sp
+struct thread_snapshot {
+	int32_t tid;
+	uint32_t flags;
+	uint32_t stack_valid; // bytes of the stack that could be read
+	uint32_t reserved;
+	struct user_pt_regs regs;
+};
+
+struct thread_snapshot_param {
+	int32_t pid;
+	uint32_t max_threads;
+	uint64_t buf; // user pointer to max_threads records
+	uint32_t stack_len; // a multiple of 8
+	uint32_t threads; // out: threads in the group, may exceed max_threads
+};
 
 struct init_device_info {
 	char proc_self_status[4096];
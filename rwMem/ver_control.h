@@ -5,6 +5,9 @@
 //直接调用内核API进行用户层数据交换
 #define CONFIG_DIRECT_API_USER_COPY
 
+//在debugfs中统计各入口的调用次数与延迟
+#define CONFIG_RWMEM_STATS
+
 //打印内核调试信息
 //#define CONFIG_DEBUG_PRINTK
 